@@ -0,0 +1,6 @@
+-- The QED of each molecule of the SDF files in benchmark/data, printed in
+-- full so that two builds can be compared row by row
+SELECT mol_to_smiles(mol) AS smiles, mol_qed(mol) AS qed
+FROM read_sdf('benchmark/data/*.sdf', COLUMNS={mol: 'Mol'})
+WHERE mol IS NOT NULL
+ORDER BY ALL;
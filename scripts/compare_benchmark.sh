@@ -0,0 +1,81 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Runs a benchmark on a build of two commits and prints the rows/sec of each.
+#
+# usage: scripts/compare_benchmark.sh <baseline commit> <patched commit> <benchmark> [<check query>]
+#
+# e.g. scripts/compare_benchmark.sh a5d733c~1 a5d733c benchmark/micro/mol_from_smiles.benchmark
+#
+# The optional check query is a SQL file that is run with the shell of both
+# builds. The script fails if the two builds print different results.
+#
+# Each commit is checked out in a worktree under build/compare and built with
+# the benchmark runner, the builds are kept so that later runs only rebuild
+# what changed.
+
+if [ "$#" -ne 3 ] && [ "$#" -ne 4 ]; then
+    echo "usage: $0 <baseline commit> <patched commit> <benchmark> [<check query>]" >&2
+    exit 1
+fi
+
+REPO_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+COMPARE_DIR="${REPO_ROOT}/build/compare"
+BENCHMARK="$3"
+CHECK_QUERY="${4:-}"
+
+# the number of rows of the benchmark is the count it checks in its result
+ROWS="$(awk '/^result I/ { getline; print $1; exit }' "${REPO_ROOT}/${BENCHMARK}")"
+if [ -z "${ROWS}" ]; then
+    echo "${BENCHMARK} has no 'result I' row count" >&2
+    exit 1
+fi
+
+build_commit() {
+    local commit="$1"
+    local worktree="${COMPARE_DIR}/$(git -C "${REPO_ROOT}" rev-parse --short "${commit}")"
+    if [ ! -d "${worktree}" ]; then
+        git -C "${REPO_ROOT}" worktree add --detach "${worktree}" "${commit}" >&2
+        git -C "${worktree}" submodule update --init --recursive >&2
+    fi
+    # the benchmark is run from the current tree, so both builds run the same one
+    (cd "${worktree}" && BUILD_BENCHMARK=1 GEN=ninja make release >&2)
+    echo "${worktree}"
+}
+
+run_benchmark() {
+    local worktree="$1"
+    # the runner prints a line per run, the timing in seconds is the last field
+    (cd "${REPO_ROOT}" && "${worktree}/build/release/benchmark/benchmark_runner" "${BENCHMARK}") |
+        awk -F'\t' '$NF ~ /^[0-9.]+$/ { print $NF }' | sort -n |
+        awk -v rows="${ROWS}" '
+            { t[n++] = $1 }
+            END {
+                if (n == 0) { exit 1 }
+                median = t[int((n - 1) / 2)]
+                printf "%d runs, median %.3f s, %.0f rows/sec\n", n, median, rows / median
+            }'
+}
+
+run_check_query() {
+    local worktree="$1"
+    (cd "${REPO_ROOT}" && "${worktree}/build/release/duckdb" -csv <"${CHECK_QUERY}")
+}
+
+BASELINE="$(build_commit "$1")"
+PATCHED="$(build_commit "$2")"
+
+echo "${BENCHMARK} (${ROWS} rows)"
+echo "baseline $1: $(run_benchmark "${BASELINE}")"
+echo "patched  $2: $(run_benchmark "${PATCHED}")"
+
+if [ -n "${CHECK_QUERY}" ]; then
+    mkdir -p "${COMPARE_DIR}"
+    run_check_query "${BASELINE}" >"${COMPARE_DIR}/baseline.csv"
+    run_check_query "${PATCHED}" >"${COMPARE_DIR}/patched.csv"
+    if ! diff -q "${COMPARE_DIR}/baseline.csv" "${COMPARE_DIR}/patched.csv" >/dev/null; then
+        echo "${CHECK_QUERY}: the results differ, see ${COMPARE_DIR}/baseline.csv and ${COMPARE_DIR}/patched.csv" >&2
+        exit 1
+    fi
+    echo "${CHECK_QUERY}: $(($(wc -l <"${COMPARE_DIR}/patched.csv") - 1)) identical rows"
+fi
@@ -1,8 +1,12 @@
+#include "bit_fp.hpp"
 #include "duckdb/common/exception.hpp"
 #include "duckdb/common/operator/cast_operators.hpp"
+#include "duckdb/common/string_util.hpp"
 #include "duckdb/common/types/string_type.hpp"
 #include "duckdb/common/types/vector.hpp"
 #include "duckdb/function/cast/default_casts.hpp"
+#include "fp_kernels.hpp"
+#include "mol_errors.hpp"
 #include "mol_formats.hpp"
 #include "types.hpp"
 #include "umbra_mol.hpp"
@@ -19,31 +23,36 @@ namespace duckdb {
 
 // This enables the user to insert into a Mol column by just writing the SMILES
 // Duckdb will try to convert the string to a rdkit mol
-// This is consistent with the RDKit Postgres cartridge behavior
-void VarcharToMol(Vector &source, Vector &result, idx_t count) {
+// This is consistent with the RDKit Postgres cartridge behavior.
+// SMILES that are not valid give NULL, and their errors are reported by
+// rdkit_last_errors()
+void VarcharToMol(Vector &source, Vector &result, idx_t count,
+                  SmilesMolParser &parser) {
   UnaryExecutor::ExecuteWithNulls<string_t, string_t>(
       source, result, count,
       [&](string_t smiles, ValidityMask &mask, idx_t idx) {
-        try {
-
-          // this varchar is just a regular string, not a umbramol
-          // Try to see if it is a SMILES
-          auto mol = rdkit_mol_from_smiles(smiles.GetString());
-          auto umbra_mol = get_umbra_mol_string(*mol);
-
-          return StringVector::AddStringOrBlob(result, umbra_mol);
-        } catch (...) {
-          std::cout << "WARNING: could not create molecule from SMILES\n"
-                    << smiles.GetData() << std::endl;
+        // this varchar is just a regular string, not a umbramol
+        // Try to see if it is a SMILES
+        auto mol = parser.Parse(smiles);
+        if (!mol) {
           mask.SetInvalid(idx);
           return string_t();
         }
+        auto umbra_mol = get_umbra_mol_string(*mol);
+        return StringVector::AddStringOrBlob(result, umbra_mol);
       });
+  parser.Flush();
 }
 
 bool VarcharToMolCast(Vector &source, Vector &result, idx_t count,
                       CastParameters &parameters) {
-  VarcharToMol(source, result, count);
+  if (parameters.local_state) {
+    VarcharToMol(source, result, count,
+                 parameters.local_state->Cast<SmilesMolParser>());
+  } else {
+    SmilesMolParser parser(parameters.context);
+    VarcharToMol(source, result, count, parser);
+  }
   return true;
 }
 
@@ -56,9 +65,12 @@ void MolToVarchar(Vector &source, Vector &result, idx_t count) {
         // Therefore, this function expects that the input
         // contains a string that has the format of umbra_mol_t.
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-
-        auto rdkit_mol = rdkit_binary_mol_to_mol(bmol);
+        // the SMILES is stored in the umbra_mol, except for molecules that
+        // were stored before it was
+        if (umbra_mol.HasSmiles()) {
+          return StringVector::AddString(result, umbra_mol.GetSmiles());
+        }
+        auto rdkit_mol = rdkit_umbra_mol_to_mol(umbra_mol);
         auto smiles = rdkit_mol_to_smiles(*rdkit_mol);
         return StringVector::AddString(result, smiles);
       });
@@ -70,12 +82,52 @@ bool MolToVarcharCast(Vector &source, Vector &result, idx_t count,
   return true;
 }
 
+// Any BLOB can be cast to BitFP, but tanimoto, dice and similarity_search
+// trust the popcount prefix. Check that the prefix is there and is the
+// popcount of the bits
+bool BlobToBitFPCast(Vector &source, Vector &result, idx_t count,
+                     CastParameters &parameters) {
+  bool all_converted = true;
+  UnaryExecutor::ExecuteWithNulls<string_t, string_t>(
+      source, result, count,
+      [&](string_t blob, ValidityMask &mask, idx_t idx) {
+        auto fp = bit_fp_t(blob);
+        string error;
+        if (fp.GetSize() < bit_fp_t::POPCOUNT_BYTES) {
+          error = StringUtil::Format(
+              "Fingerprint is too short to be a BitFP (%llu bytes, at least "
+              "%llu needed)",
+              fp.GetSize(), bit_fp_t::POPCOUNT_BYTES);
+        } else {
+          auto popcount = fp_popcount(fp.GetBits(), fp.GetNumBytes());
+          if (popcount != fp.GetPopcount()) {
+            error = StringUtil::Format(
+                "BitFP popcount prefix is %llu, but %llu bits are set",
+                idx_t(fp.GetPopcount()), popcount);
+          }
+        }
+        if (!error.empty()) {
+          HandleCastError::AssignError(error, parameters);
+          mask.SetInvalid(idx);
+          all_converted = false;
+          return string_t();
+        }
+        return StringVector::AddStringOrBlob(result, blob);
+      });
+  return all_converted;
+}
+
 void RegisterCasts(ExtensionLoader &loader) {
   loader.RegisterCastFunction(LogicalType::VARCHAR, Mol(),
-                              BoundCastInfo(VarcharToMolCast), 1);
+                              BoundCastInfo(VarcharToMolCast, nullptr,
+                                            SmilesMolParser::InitCastLocalState),
+                              1);
 
   loader.RegisterCastFunction(Mol(), LogicalType::VARCHAR,
                               BoundCastInfo(MolToVarcharCast), 1);
+
+  loader.RegisterCastFunction(LogicalType::BLOB, BitFP(),
+                              BoundCastInfo(BlobToBitFPCast), 1);
 }
 
 } // namespace duckdb
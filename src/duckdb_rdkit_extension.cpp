@@ -1,7 +1,13 @@
 #include "duckdb/common/types.hpp"
 #include "duckdb/main/extension/extension_loader.hpp"
+#include "mol_cache.hpp"
 #include "mol_descriptors.hpp"
+#include "mol_errors.hpp"
+#include "mol_fingerprint.hpp"
+#include "mol_sss_index/mol_sss_index.hpp"
 #include "sdf_scanner/sdf_functions.hpp"
+#include "similarity_search.hpp"
+#include "substruct_join.hpp"
 
 #define DUCKDB_EXTENSION_MAIN
 #include "cast.hpp"
@@ -26,14 +32,22 @@ static void LoadInternal(ExtensionLoader &loader) {
   RegisterFormatFunctions(loader);
   RegisterCompareFunctions(loader);
   RegisterDescriptorFunctions(loader);
+  RegisterFingerprintFunctions(loader);
+  RegisterSimilaritySearchFunctions(loader);
+  RegisterSubstructJoinFunctions(loader);
+  RegisterMolSSSIndex(loader);
+  RegisterMolCacheFunctions(loader);
+  RegisterMolErrorFunctions(loader);
 
   for (auto &fun : SDFFunctions::GetTableFunctions()) {
     loader.RegisterFunction(fun);
   }
+  loader.RegisterFunction(SDFFunctions::GetCopyFunction());
 
   // SDF replacement scan
   auto &config = DBConfig::GetConfig(loader.GetDatabaseInstance());
   config.replacement_scans.emplace_back(SDFFunctions::ReadSDFReplacement);
+  config.optimizer_extensions.push_back(SDFFunctions::GetOptimizerExtension());
 }
 
 void DuckdbRdkitExtension::Load(ExtensionLoader &loader) {
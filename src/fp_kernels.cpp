@@ -0,0 +1,192 @@
+#include "fp_kernels.hpp"
+#include <bitset>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DUCKDB_RDKIT_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace duckdb {
+
+static inline idx_t popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(x);
+#else
+  return std::bitset<64>(x).count();
+#endif
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+// The bytes that do not fill up a 64 bit word at the end of the fingerprint
+static inline idx_t popcount_tail(const uint8_t *a, idx_t num_bytes) {
+  idx_t count = 0;
+  for (idx_t i = 0; i < num_bytes; i++) {
+    count += popcount64(a[i]);
+  }
+  return count;
+}
+
+static inline idx_t popcount_and_tail(const uint8_t *a, const uint8_t *b,
+                                      idx_t num_bytes) {
+  idx_t count = 0;
+  for (idx_t i = 0; i < num_bytes; i++) {
+    count += popcount64(a[i] & b[i]);
+  }
+  return count;
+}
+
+//===--------------------------------------------------------------------===//
+// Portable kernels
+//===--------------------------------------------------------------------===//
+static idx_t popcount_portable(const uint8_t *a, idx_t num_bytes) {
+  idx_t count = 0;
+  idx_t i = 0;
+  for (; i + 8 <= num_bytes; i += 8) {
+    count += popcount64(load64(a + i));
+  }
+  return count + popcount_tail(a + i, num_bytes - i);
+}
+
+static idx_t popcount_and_portable(const uint8_t *a, const uint8_t *b,
+                                   idx_t num_bytes) {
+  idx_t count = 0;
+  idx_t i = 0;
+  for (; i + 8 <= num_bytes; i += 8) {
+    count += popcount64(load64(a + i) & load64(b + i));
+  }
+  return count + popcount_and_tail(a + i, b + i, num_bytes - i);
+}
+
+#ifdef DUCKDB_RDKIT_X86_KERNELS
+//===--------------------------------------------------------------------===//
+// POPCNT kernels
+//===--------------------------------------------------------------------===//
+// The same as the portable kernels, but compiled so that __builtin_popcountll
+// becomes the POPCNT instruction
+__attribute__((target("popcnt"))) static idx_t
+popcount_popcnt(const uint8_t *a, idx_t num_bytes) {
+  idx_t count = 0;
+  idx_t i = 0;
+  for (; i + 8 <= num_bytes; i += 8) {
+    count += __builtin_popcountll(load64(a + i));
+  }
+  for (; i < num_bytes; i++) {
+    count += __builtin_popcountll(a[i]);
+  }
+  return count;
+}
+
+__attribute__((target("popcnt"))) static idx_t
+popcount_and_popcnt(const uint8_t *a, const uint8_t *b, idx_t num_bytes) {
+  idx_t count = 0;
+  idx_t i = 0;
+  for (; i + 8 <= num_bytes; i += 8) {
+    count += __builtin_popcountll(load64(a + i) & load64(b + i));
+  }
+  for (; i < num_bytes; i++) {
+    count += __builtin_popcountll(a[i] & b[i]);
+  }
+  return count;
+}
+
+//===--------------------------------------------------------------------===//
+// AVX2 kernels
+//===--------------------------------------------------------------------===//
+// AVX2 has no popcount instruction. The bits set in each 4 bit nibble are
+// looked up with a byte shuffle, and the byte counts are summed into 64 bit
+// lanes with _mm256_sad_epu8.
+// See: Mula, Kurz, Lemire (2018) 'Faster Population Counts Using AVX2
+// Instructions', The Computer Journal, 61(1)
+__attribute__((target("avx2"))) static inline __m256i
+popcount256(__m256i v) {
+  const __m256i lookup =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                       2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0F);
+  auto lo = _mm256_and_si256(v, low_mask);
+  auto hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  auto byte_counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                     _mm256_shuffle_epi8(lookup, hi));
+  return _mm256_sad_epu8(byte_counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2"))) static inline idx_t sum256(__m256i v) {
+  return idx_t(_mm256_extract_epi64(v, 0)) +
+         idx_t(_mm256_extract_epi64(v, 1)) +
+         idx_t(_mm256_extract_epi64(v, 2)) + idx_t(_mm256_extract_epi64(v, 3));
+}
+
+__attribute__((target("avx2,popcnt"))) static idx_t
+popcount_avx2(const uint8_t *a, idx_t num_bytes) {
+  auto acc = _mm256_setzero_si256();
+  idx_t i = 0;
+  for (; i + 32 <= num_bytes; i += 32) {
+    auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    acc = _mm256_add_epi64(acc, popcount256(va));
+  }
+  return sum256(acc) + popcount_popcnt(a + i, num_bytes - i);
+}
+
+__attribute__((target("avx2,popcnt"))) static idx_t
+popcount_and_avx2(const uint8_t *a, const uint8_t *b, idx_t num_bytes) {
+  auto acc = _mm256_setzero_si256();
+  idx_t i = 0;
+  for (; i + 32 <= num_bytes; i += 32) {
+    auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    acc = _mm256_add_epi64(acc, popcount256(_mm256_and_si256(va, vb)));
+  }
+  return sum256(acc) + popcount_and_popcnt(a + i, b + i, num_bytes - i);
+}
+#endif
+
+//===--------------------------------------------------------------------===//
+// Dispatch
+//===--------------------------------------------------------------------===//
+typedef idx_t (*popcount_fun_t)(const uint8_t *, idx_t);
+typedef idx_t (*popcount_and_fun_t)(const uint8_t *, const uint8_t *, idx_t);
+
+static popcount_fun_t select_popcount() {
+#ifdef DUCKDB_RDKIT_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return popcount_avx2;
+  }
+  if (__builtin_cpu_supports("popcnt")) {
+    return popcount_popcnt;
+  }
+#endif
+  return popcount_portable;
+}
+
+static popcount_and_fun_t select_popcount_and() {
+#ifdef DUCKDB_RDKIT_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return popcount_and_avx2;
+  }
+  if (__builtin_cpu_supports("popcnt")) {
+    return popcount_and_popcnt;
+  }
+#endif
+  return popcount_and_portable;
+}
+
+idx_t fp_popcount(const uint8_t *a, idx_t num_bytes) {
+  // the kernel is selected once, the first time this is called
+  static const popcount_fun_t kernel = select_popcount();
+  return kernel(a, num_bytes);
+}
+
+idx_t fp_popcount_and(const uint8_t *a, const uint8_t *b, idx_t num_bytes) {
+  static const popcount_and_fun_t kernel = select_popcount_and();
+  return kernel(a, b, num_bytes);
+}
+
+} // namespace duckdb
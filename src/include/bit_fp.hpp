@@ -0,0 +1,69 @@
+#pragma once
+#include "common.hpp"
+#include "duckdb/common/typedefs.hpp"
+#include <cstdint>
+#include <cstring>
+
+namespace duckdb {
+
+// bit_fp_t is the representation of the BitFP type, a fixed-width bit
+// fingerprint (e.g. a Morgan/ECFP fingerprint). Like umbra_mol_t, it is a
+// string_t under the hood, and has a prefix in front of the data:
+//
+//  [ popcount: 4 bytes, big endian ][ fingerprint: nbits / 8 bytes ]
+//
+// The popcount (number of bits set) is what is needed for the denominator of
+// tanimoto and dice, so only the popcount of the intersection of two
+// fingerprints has to be computed.
+//
+// The popcount takes up the 4 byte prefix that duckdb inlines in the
+// string_t, so it can be read without chasing the pointer to the data. It is
+// big endian so that comparing two BitFP blobs (memcmp) orders them by
+// popcount. This makes the min/max statistics duckdb keeps for each row group
+// a popcount range, which can be used to skip row groups in a similarity
+// search.
+//
+// Bit i of the fingerprint is bit (i % 8) of byte (i / 8).
+struct bit_fp_t {
+  string_t &string_t_bit_fp;
+
+  bit_fp_t(string_t &buffer) : string_t_bit_fp(buffer) {}
+
+  static constexpr idx_t POPCOUNT_BYTES = sizeof(uint32_t);
+  // fingerprints are made up of 64 bit words
+  static constexpr idx_t WORD_BITS = 64;
+
+  static void EncodePopcount(uint32_t popcount, char *dst) {
+    dst[0] = char((popcount >> 24) & 0xFF);
+    dst[1] = char((popcount >> 16) & 0xFF);
+    dst[2] = char((popcount >> 8) & 0xFF);
+    dst[3] = char(popcount & 0xFF);
+  }
+
+  static uint32_t DecodePopcount(const char *src) {
+    auto p = const_data_ptr_cast(src);
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+           (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+  }
+
+  // Reads the popcount from the inlined prefix
+  uint32_t GetPopcount() const {
+    return DecodePopcount(string_t_bit_fp.GetPrefix());
+  }
+
+  idx_t GetNumBytes() const {
+    return string_t_bit_fp.GetSize() - POPCOUNT_BYTES;
+  }
+
+  idx_t GetNumBits() const { return GetNumBytes() * 8; }
+
+  const uint8_t *GetBits() const {
+    return const_data_ptr_cast(string_t_bit_fp.GetData() + POPCOUNT_BYTES);
+  }
+
+  idx_t GetSize() const { return string_t_bit_fp.GetSize(); }
+
+  const char *GetData() const { return string_t_bit_fp.GetData(); }
+};
+
+} // namespace duckdb
@@ -0,0 +1,17 @@
+#pragma once
+#include "duckdb/common/typedefs.hpp"
+#include <cstdint>
+
+namespace duckdb {
+
+// Popcount kernels for fingerprints. On x86-64 an AVX2 or a POPCNT kernel is
+// picked at runtime, depending on what the CPU supports. Otherwise, a
+// portable kernel is used.
+
+// Number of bits set in `a`, which is `num_bytes` long
+idx_t fp_popcount(const uint8_t *a, idx_t num_bytes);
+
+// Number of bits set in both `a` and `b`, which are each `num_bytes` long
+idx_t fp_popcount_and(const uint8_t *a, const uint8_t *b, idx_t num_bytes);
+
+} // namespace duckdb
@@ -0,0 +1,80 @@
+#pragma once
+#include "common.hpp"
+#include "duckdb/common/typedefs.hpp"
+#include "duckdb/execution/expression_executor_state.hpp"
+#include "umbra_mol.hpp"
+#include <GraphMol/GraphMol.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace duckdb {
+
+// A small per thread cache of deserialized molecules.
+//
+// A query such as SELECT mol_amw(m), mol_logp(m), mol_tpsa(m) FROM t
+// evaluates each function on the whole chunk, one function after the other,
+// so without the cache the same molecule is deserialized once per function.
+// The cache holds a chunk worth of molecules, so the functions after the
+// first one find the molecule already deserialized.
+//
+// The functions of one chunk see the same umbra_mol at the same address, so
+// molecules are looked up by the address and size of the umbra_mol, without
+// hashing its content. The buffers of a chunk are reused for the next one, so
+// each entry keeps a copy of its umbra_mol, and a match of the address and
+// size is confirmed by comparing the content with the copy.
+//
+// Each thread has its own cache per query, so no locks are needed. The
+// caches of a query are owned by the connection, and are released when the
+// query ends.
+class DecodedMolCache {
+public:
+  // the number of molecules in the cache, twice a chunk so that the
+  // molecules of a chunk rarely evict each other
+  static constexpr idx_t CAPACITY = 2 * STANDARD_VECTOR_SIZE;
+  // the number of slots a molecule can be stored in
+  static constexpr idx_t WAYS = 4;
+
+  DecodedMolCache(ClientContext &context, transaction_t query_id);
+  // adds the hits and misses of the cache to the totals
+  ~DecodedMolCache();
+
+  // Returns the cache of the calling thread for the query of the state
+  static DecodedMolCache &Get(ExpressionState &state);
+
+  // Returns the deserialized molecule, from the cache if possible. The
+  // molecule must not be modified: it is shared with the next lookup of the
+  // same umbra_mol
+  std::shared_ptr<const RDKit::ROMol> GetMol(umbra_mol_t umbra_mol);
+
+  // the number of lookups that found or did not find the molecule, summed
+  // over the caches of all the queries that have ended
+  static std::atomic<idx_t> total_hits;
+  static std::atomic<idx_t> total_misses;
+
+private:
+  struct Entry {
+    // the address of the umbra_mol the molecule was deserialized from
+    const char *data = nullptr;
+    // a copy of the umbra_mol, to tell a reused address apart
+    std::string bytes;
+    // the lookup that last used the entry, to evict the oldest of a set
+    idx_t last_use = 0;
+    std::shared_ptr<const RDKit::ROMol> mol;
+  };
+
+  // set associative on the address of the umbra_mol
+  std::vector<Entry> entries;
+  idx_t lookups = 0;
+  // only the owning thread counts, the totals are updated once at the end
+  idx_t hits = 0;
+  idx_t misses = 0;
+  // the query the cache is used for
+  ClientContext &context;
+  transaction_t query_id;
+};
+
+void RegisterMolCacheFunctions(ExtensionLoader &loader);
+
+} // namespace duckdb
@@ -1,6 +1,48 @@
 #pragma once
 #include "common.hpp"
+#include "mol_cache.hpp"
+#include "umbra_mol.hpp"
+#include <GraphMol/GraphMol.h>
+#include <memory>
 
 namespace duckdb {
+
+// A query molecule that has been deserialized once so that it can be reused
+// for every row that it is compared against. This is used when the query
+// (right-hand side) of is_substruct or is_exact_match is a constant, which
+// is by far the most common case, e.g. is_substruct(mol, 'c1ccccc1N').
+//
+// It is never modified after construction and is shared read-only between
+// all threads executing the query.
+struct CompiledQueryMol {
+  explicit CompiledQueryMol(string_t &umbra_mol_blob);
+
+  // Returns true if this was compiled from the same umbra_mol bytes
+  bool Matches(const string_t &umbra_mol_blob) const;
+
+  // the deserialized RDKit molecule
+  std::unique_ptr<RDKit::ROMol> mol;
+  // the 4 byte prefix of the dalke_fp that is inlined in the string_t
+  uint32_t prefix;
+  // the entire dalke_fp (screen word)
+  uint64_t dalke_fp;
+  // the canonical hash of this build, from the umbra_mol or computed for
+  // molecules that were stored without it or by another RDKit release
+  uint64_t hash;
+  // RDKit::MolToSmiles sets computed properties on the molecule it is called
+  // with, so it cannot be called on the shared molecule from several threads.
+  // Compute the SMILES that mol_cmp needs once, up front.
+  std::string smiles;
+  // the umbra_mol this was compiled from
+  std::string umbra_mol;
+};
+
+// The target, and the query if it is not compiled, are deserialized through
+// the molecule cache of the calling thread
+bool _is_substruct(umbra_mol_t target, umbra_mol_t query,
+                   DecodedMolCache &cache);
+bool _is_substruct(umbra_mol_t target, const CompiledQueryMol &query,
+                   DecodedMolCache &cache);
+
 void RegisterCompareFunctions(ExtensionLoader &loader);
 } // namespace duckdb
@@ -0,0 +1,96 @@
+#pragma once
+#include "duckdb/common/mutex.hpp"
+#include "duckdb/function/cast/default_casts.hpp"
+#include "duckdb/function/scalar_function.hpp"
+#include "duckdb/main/client_context.hpp"
+#include "duckdb/main/client_context_state.hpp"
+#include "duckdb/main/extension/extension_loader.hpp"
+#include <GraphMol/GraphMol.h>
+#include <GraphMol/SmilesParse/SmilesParse.h>
+#include <memory>
+
+namespace duckdb {
+
+// An input that no molecule could be made from, and why
+struct MolError {
+  string input;
+  string message;
+};
+
+// The errors of making molecules, per connection. Bad inputs give NULL
+// molecules, and their errors are collected here instead of being printed,
+// so that bulk loads do not serialize the threads on stdout. The errors of
+// the last query that made molecules are returned by rdkit_last_errors().
+class MolErrorState : public ClientContextState {
+public:
+  // at most this many errors are kept per query
+  static constexpr idx_t MAX_ERRORS = 10000;
+
+  static shared_ptr<MolErrorState> Get(ClientContext &context);
+
+  // the errors of the previous query become the last errors, if it made any
+  // molecules
+  void QueryBegin(ClientContext &context) override;
+
+  // Adds the errors of a chunk. Threads collect their errors and add them
+  // once per chunk, so the lock is not taken per row
+  void AddErrors(vector<MolError> &errors);
+  vector<MolError> GetLastErrors();
+
+private:
+  mutex lock;
+  // whether the running query made molecules
+  bool made_molecules = false;
+  vector<MolError> errors;
+  vector<MolError> last_errors;
+};
+
+// Turns the RDKit logs off while it exists. RDKit logs the error of every
+// molecule it cannot make to stderr, behind a lock that serializes the
+// threads, and the errors are reported by rdkit_last_errors() instead. The
+// RDKit logs are global, so the first blocker turns them off and the last one
+// turns them back on. Keep one per thread state rather than one per row, the
+// blockers share a lock
+class RDKitLogBlocker {
+public:
+  RDKitLogBlocker();
+  ~RDKitLogBlocker();
+
+  RDKitLogBlocker(const RDKitLogBlocker &) = delete;
+  RDKitLogBlocker &operator=(const RDKitLogBlocker &) = delete;
+};
+
+// Makes molecules from SMILES for one thread. The parser parameters and the
+// buffer for the SMILES are reused for all rows, and the errors are collected
+// until Flush, which is called once per chunk.
+class SmilesMolParser : public FunctionLocalState {
+public:
+  explicit SmilesMolParser(optional_ptr<ClientContext> context);
+
+  // Returns nullptr if no molecule can be made from the SMILES, and
+  // records the error
+  std::unique_ptr<RDKit::ROMol> Parse(string_t smiles);
+  // The error of the last failed Parse
+  const string &LastError() const { return last_error; }
+  // Hands the collected errors to the MolErrorState of the connection
+  void Flush();
+
+  static unique_ptr<FunctionLocalState>
+  InitCastLocalState(CastLocalStateParameters &parameters);
+  static unique_ptr<FunctionLocalState>
+  InitFunctionLocalState(ExpressionState &state,
+                         const BoundFunctionExpression &expr,
+                         FunctionData *bind_data);
+
+private:
+  RDKit::SmilesParserParams params;
+  std::string buffer;
+  string last_error;
+  vector<MolError> errors;
+  shared_ptr<MolErrorState> error_state;
+  RDKitLogBlocker log_blocker;
+};
+
+void RegisterMolErrorFunctions(ExtensionLoader &loader);
+
+} // namespace duckdb
@@ -0,0 +1,13 @@
+#pragma once
+#include "bit_fp.hpp"
+#include "common.hpp"
+
+namespace duckdb {
+
+// Similarity of two fingerprints of the same length.
+// Two fingerprints without any bits set are considered identical
+double tanimoto_similarity(bit_fp_t a, bit_fp_t b);
+double dice_similarity(bit_fp_t a, bit_fp_t b);
+
+void RegisterFingerprintFunctions(ExtensionLoader &loader);
+} // namespace duckdb
@@ -1,17 +1,39 @@
 #pragma once
 
 #include "duckdb/main/extension/extension_loader.hpp"
+#include "umbra_mol.hpp"
 #include <GraphMol/GraphMol.h>
 #include <memory>
+#include <streambuf>
 
 namespace duckdb {
 
+// A read-only stream buffer over memory owned by someone else. MolPickler
+// reads from a std::istream, and its std::string overload copies the pickle
+// into a std::stringstream first. This lets the pickle be read directly out
+// of the string_t of a umbra_mol instead. The SDF scanner also uses it to
+// parse the records of a byte range of the file out of its buffer.
+class ReadOnlyMemoryBuf : public std::streambuf {
+public:
+  ReadOnlyMemoryBuf(const char *data, idx_t size) {
+    // std::streambuf wants char *, but the get area is never written to
+    auto begin = const_cast<char *>(data);
+    setg(begin, begin, begin + size);
+  }
+};
+
 // these functions are used in other parts of the extension, for example in
 // casts
 std::unique_ptr<RDKit::ROMol> rdkit_mol_from_smiles(std::string s);
-std::string rdkit_mol_to_binary_mol(const RDKit::ROMol mol);
-std::unique_ptr<RDKit::ROMol> rdkit_binary_mol_to_mol(std::string bmol);
-std::string rdkit_mol_to_smiles(RDKit::ROMol mol);
+std::string rdkit_mol_to_binary_mol(const RDKit::ROMol &mol);
+std::unique_ptr<RDKit::ROMol> rdkit_binary_mol_to_mol(const char *bmol,
+                                                      idx_t size);
+std::unique_ptr<RDKit::ROMol> rdkit_binary_mol_to_mol(const std::string &bmol);
+// deserializes the molecule of a umbra_mol without copying the binary mol
+std::unique_ptr<RDKit::ROMol> rdkit_umbra_mol_to_mol(umbra_mol_t umbra_mol);
+// RDKit sets computed properties on the molecule, do not call this on a
+// molecule that is shared between threads
+std::string rdkit_mol_to_smiles(const RDKit::ROMol &mol);
 
 void RegisterFormatFunctions(ExtensionLoader &loader);
 } // namespace duckdb
@@ -0,0 +1,169 @@
+#pragma once
+#include "common.hpp"
+#include "duckdb/common/mutex.hpp"
+#include "duckdb/execution/index/bound_index.hpp"
+#include "duckdb/execution/index/fixed_size_allocator.hpp"
+#include "duckdb/execution/index/index_pointer.hpp"
+#include "umbra_mol.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace duckdb {
+
+class PhysicalOperator;
+struct PlanIndexInput;
+
+// Which fingerprint the MOL_SSS index screens on
+enum class MolSSSScreen : uint8_t {
+  // the 55 dalke bits stored in the prefix of every umbra_mol. These do not
+  // need the molecule to be deserialized
+  DALKE = 0,
+  // the RDKit pattern fingerprint, which is wider and screens out more
+  // molecules, but has to be computed from the molecule
+  PATTERN = 1
+};
+
+// An inverted bitmap per screen bit: bit r of bitmap b is set if the
+// molecule in row r has screen bit b set. Candidates for a substructure
+// search are the AND of the bitmaps of the bits set in the query.
+//
+// The bitmaps are dense, and all have the same number of words, so they can
+// be ANDed word by word.
+//
+// For every row group there is also a summary of the screen bits of its
+// rows, the same short-circuit that _is_substruct does per row: if a query
+// bit is not set in any row of the row group, none of its rows can match,
+// and its words are not ANDed at all. Rare fragments skip most row groups,
+// especially when the table is ordered so that similar molecules are
+// stored together.
+class MolSSSBitmaps {
+public:
+  explicit MolSSSBitmaps(idx_t screen_bits);
+
+  // Add the row with the given screen bits
+  void Add(row_t row_id, const std::vector<idx_t> &screen);
+  // Remove the row, clearing all its bits
+  void Remove(row_t row_id);
+  // OR the rows of other into this one
+  void Merge(const MolSSSBitmaps &other);
+  // Returns the rows that have all of the query bits set, in ascending order
+  std::vector<row_t> Search(const std::vector<idx_t> &query) const;
+
+  idx_t GetScreenBits() const { return bitmaps.size(); }
+  idx_t GetRowCount() const { return row_count; }
+  idx_t GetInMemorySize() const;
+  // Returns the number of row groups whose summary has all the query bits
+  idx_t CountCandidateRowGroups(const std::vector<idx_t> &query) const;
+
+  // (de)serialization as a flat sequence of bytes
+  template <class WRITER> void Serialize(WRITER &writer) const;
+  template <class READER> void Deserialize(READER &reader);
+
+private:
+  void Reserve(idx_t num_words);
+  bool RowGroupMayMatch(idx_t row_group,
+                        const std::vector<idx_t> &query) const;
+  // recomputes the row group summaries from the bitmaps
+  void ComputeRowGroupSummaries();
+
+  // the number of 64 bit words in each bitmap
+  idx_t num_words = 0;
+  // the rows that are in the index
+  std::vector<uint64_t> rows;
+  // one bitmap per screen bit
+  std::vector<std::vector<uint64_t>> bitmaps;
+  // the number of rows that have each screen bit set. Used to AND the
+  // rarest bits first
+  std::vector<idx_t> bit_counts;
+  // the number of rows with each screen bit set per row group, indexed by
+  // row_group * screen_bits + bit. A count > 0 is the OR of the screens of
+  // the row group; counting instead of ORing supports Remove
+  std::vector<uint32_t> row_group_bit_counts;
+  idx_t row_count = 0;
+};
+
+// CREATE INDEX idx ON tbl USING MOL_SSS (mol_column)
+//
+// A substructure screening index on a Mol column. A query with
+// `WHERE is_substruct(mol_column, <constant>)` on an indexed table only
+// fetches the rows whose screen contains the screen of the query, instead
+// of scanning the whole table. is_substruct is still evaluated on the
+// fetched rows, the screen only removes rows that cannot match.
+//
+// Options (WITH (...)):
+// - fingerprint: 'dalke' (default) or 'pattern'
+// - bits: the number of bits of the pattern fingerprint (default 1024)
+class MolSSSIndex : public BoundIndex {
+public:
+  static constexpr const char *TYPE_NAME = "MOL_SSS";
+  static constexpr idx_t DEFAULT_PATTERN_BITS = 1024;
+
+  MolSSSIndex(const string &name, IndexConstraintType index_constraint_type,
+              const vector<column_t> &column_ids,
+              TableIOManager &table_io_manager,
+              const vector<unique_ptr<Expression>> &unbound_expressions,
+              AttachedDatabase &db,
+              const case_insensitive_map_t<Value> &options,
+              const IndexStorageInfo &info = IndexStorageInfo());
+
+  static PhysicalOperator &CreatePlan(PlanIndexInput &input);
+  // Reads the screen options, and throws if they are invalid
+  static void ParseOptions(const case_insensitive_map_t<Value> &options,
+                           MolSSSScreen &screen, idx_t &screen_bits);
+  // Computes the screen (the positions of the bits that are set) of a
+  // molecule
+  static std::vector<idx_t> ComputeScreen(MolSSSScreen screen,
+                                          idx_t screen_bits,
+                                          umbra_mol_t umbra_mol);
+
+  std::vector<idx_t> ComputeScreen(umbra_mol_t umbra_mol) const {
+    return ComputeScreen(screen, screen_bits, umbra_mol);
+  }
+  // Returns the candidate rows for the substructure query
+  std::vector<row_t> Search(umbra_mol_t query);
+  // Upper bound of the number of candidate rows, from the row group
+  // summaries only
+  idx_t EstimateCardinality(umbra_mol_t query);
+  // Replaces the content of the index, used when the index is created
+  void Build(MolSSSBitmaps bitmaps);
+
+public:
+  //! BoundIndex overrides
+  ErrorData Append(IndexLock &lock, DataChunk &entries,
+                   Vector &row_identifiers) override;
+  ErrorData Insert(IndexLock &lock, DataChunk &data, Vector &row_ids) override;
+  void Delete(IndexLock &lock, DataChunk &entries,
+              Vector &row_identifiers) override;
+  void CommitDrop(IndexLock &index_lock) override;
+  IndexStorageInfo GetStorageInfo(const case_insensitive_map_t<Value> &options,
+                                  const bool to_wal) override;
+  idx_t GetInMemorySize(IndexLock &state) override;
+  bool MergeIndexes(IndexLock &state, BoundIndex &other_index) override;
+  void Vacuum(IndexLock &state) override;
+  string VerifyAndToString(IndexLock &state, const bool only_verify) override;
+  void VerifyAllocations(IndexLock &state) override;
+  string GetConstraintViolationMessage(VerifyExistenceType verify_type,
+                                       idx_t failed_index,
+                                       DataChunk &input) override {
+    return "Constraint violation in MOL_SSS index";
+  }
+
+private:
+  void PersistToDisk();
+
+  MolSSSScreen screen;
+  idx_t screen_bits;
+
+  mutex bitmaps_lock;
+  MolSSSBitmaps bitmaps;
+  // true if the bitmaps changed since they were last written to disk
+  bool is_dirty = false;
+
+  // the serialized bitmaps are stored in a linked list of blocks
+  unique_ptr<FixedSizeAllocator> linked_block_allocator;
+  IndexPointer root_block_ptr;
+};
+
+void RegisterMolSSSIndex(ExtensionLoader &loader);
+
+} // namespace duckdb
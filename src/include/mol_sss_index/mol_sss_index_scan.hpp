@@ -0,0 +1,26 @@
+#pragma once
+#include "common.hpp"
+#include "duckdb/function/table_function.hpp"
+#include "duckdb/main/extension/extension_loader.hpp"
+
+namespace duckdb {
+
+// Scans the rows of a table whose screen matches the screen of a
+// substructure query, using a MOL_SSS index.
+//
+// This is not called directly. An optimizer rule replaces the scan of a
+// table that has a MOL_SSS index with this function when the scan is
+// filtered with is_substruct(indexed_column, <constant>). The filter is
+// kept above the scan, so that is_substruct is still evaluated on the
+// candidate rows.
+//
+// The candidates are read per row group: row groups without candidates are
+// not read at all, row groups with many candidates are scanned sequentially
+// and the candidates of the others are fetched by row id.
+struct MolSSSIndexScanFunction {
+  static TableFunction GetFunction();
+};
+
+void RegisterMolSSSIndexScan(ExtensionLoader &loader);
+
+} // namespace duckdb
@@ -0,0 +1,56 @@
+#pragma once
+#include "common.hpp"
+#include "duckdb/catalog/catalog_entry/duck_table_entry.hpp"
+#include "duckdb/execution/physical_operator.hpp"
+#include "duckdb/parser/parsed_data/create_index_info.hpp"
+
+namespace duckdb {
+
+// Builds a MOL_SSS index. The input is the indexed Mol column and the row
+// id. Every thread builds the bitmaps of the rows it sees, and they are ORed
+// together when the threads are done.
+class PhysicalCreateMolSSSIndex : public PhysicalOperator {
+public:
+  static constexpr const PhysicalOperatorType TYPE =
+      PhysicalOperatorType::EXTENSION;
+
+  PhysicalCreateMolSSSIndex(PhysicalPlan &physical_plan,
+                            const vector<LogicalType> &types_p,
+                            TableCatalogEntry &table,
+                            const vector<column_t> &column_ids,
+                            unique_ptr<CreateIndexInfo> info,
+                            vector<unique_ptr<Expression>> unbound_expressions,
+                            idx_t estimated_cardinality);
+
+  DuckTableEntry &table;
+  vector<column_t> storage_ids;
+  unique_ptr<CreateIndexInfo> info;
+  vector<unique_ptr<Expression>> unbound_expressions;
+
+public:
+  // Source interface, this operator does not produce any rows
+  SourceResultType GetData(ExecutionContext &context, DataChunk &chunk,
+                           OperatorSourceInput &input) const override {
+    return SourceResultType::FINISHED;
+  }
+  bool IsSource() const override { return true; }
+
+public:
+  // Sink interface
+  unique_ptr<GlobalSinkState>
+  GetGlobalSinkState(ClientContext &context) const override;
+  unique_ptr<LocalSinkState>
+  GetLocalSinkState(ExecutionContext &context) const override;
+  SinkResultType Sink(ExecutionContext &context, DataChunk &chunk,
+                      OperatorSinkInput &input) const override;
+  SinkCombineResultType Combine(ExecutionContext &context,
+                                OperatorSinkCombineInput &input) const override;
+  SinkFinalizeType Finalize(Pipeline &pipeline, Event &event,
+                            ClientContext &context,
+                            OperatorSinkFinalizeInput &input) const override;
+
+  bool IsSink() const override { return true; }
+  bool ParallelSink() const override { return true; }
+};
+
+} // namespace duckdb
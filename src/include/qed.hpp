@@ -1,8 +1,10 @@
 #pragma once
 
-#include <GraphMol/SmilesParse/SmilesParse.h>
-#include <memory>
-#include <unordered_map>
+#include <GraphMol/RWMol.h>
+#include <GraphMol/Substruct/SubstructMatch.h>
+#include <array>
+#include <string>
+#include <vector>
 
 namespace duckdb {
 
@@ -14,96 +16,112 @@ namespace duckdb {
 // 90-98
 class QED {
 public:
-  QED() {
-    acceptorMols = smarts2mols(acceptorSmarts);
-    alertMols = smarts2mols(structuralAlertSmarts);
-    aliphaticRingsMol.reset(RDKit::SmartsToMol(aliphaticRingSmarts));
-  }
+  // Scratch space of CalcQED that is reused from one molecule to the next.
+  // Create one per chunk (or thread), it is not shared between threads.
+  struct Buffers {
+    RDKit::MatchVectType matchVect;
+    std::vector<RDKit::MatchVectType> matches;
+    std::vector<bool> deleted;
+    std::vector<unsigned int> parents;
+  };
+
+  // The QED patterns are compiled once per process, and all threads share
+  // them. Initialization of a function-local static is thread-safe, and
+  // CalcQED does not modify the patterns.
+  static const QED &Get();
 
-  float CalcQED(const RDKit::ROMol &mol);
+  float CalcQED(const RDKit::ROMol &mol, Buffers &buffers) const;
+  // Same as above, for when the molecular weight, Crippen LogP, number of H
+  // bond donors and TPSA of the molecule are already calculated, e.g. by
+  // mol_descriptors
+  float CalcQED(const RDKit::ROMol &mol, double amw, double crippenLogP,
+                unsigned int hbd, double psa, Buffers &buffers) const;
 
 private:
+  QED();
+
+  // The properties of a molecule that QED is calculated from, in the order
+  // of the arrays below
+  enum Property {
+    // molecular weight
+    MW,
+    // Crippen logp
+    ALOGP,
+    // number of hydrogen bond acceptors
+    HBA,
+    // number of hydrogen bond donors
+    HBD,
+    // polar surface area
+    PSA,
+    // number of rotatable bonds
+    ROTB,
+    // number of aromatic rings
+    AROM,
+    // alerts = from the QED paper:"a substructure search was performed
+    // against each drug using a curated reference set of 94 functional
+    // moieties that are potentially mutagenic, reactive or have unfavourable
+    // pharmacokinetic properties"
+    ALERTS,
+    PROPERTY_COUNT
+  };
+
   struct ADSparameter {
     double A, B, C, D, E, F, DMAX;
   };
 
-  struct QEDproperties {
-    std::unordered_map<std::string, float> data;
-
-    // This constructor populates the internal map that stores the calculated
-    // properties for the molecule we are calculating the QED for.
-    // these fields need to be floats because the weights can be floats
-    QEDproperties(float mw, float alogp, float hba, float hbd, float psa,
-                  float rotb, float arom, float alerts) {
-      // molecular weight
-      data["MW"] = mw;
-      // Crippen logp
-      data["ALOGP"] = alogp;
-      // number of hydrogen bond acceptors
-      data["HBA"] = hba;
-      // number of hydrogen bond donors
-      data["HBD"] = hbd;
-      // polar surface area
-      data["PSA"] = psa;
-      // number of rotatable bonds
-      data["ROTB"] = rotb;
-      // number of aromatic rings
-      data["AROM"] = arom;
-      // alerts = from the QED paper:"a substructure search was performed
-      // against each drug using a curated reference set of 94 functional
-      // moieties that are potentially mutagenic, reactive or have unfavourable
-      // pharmacokinetic properties"
-      data["ALERTS"] = alerts;
-    };
-  };
+  // these fields need to be floats because the weights can be floats
+  using QEDproperties = std::array<float, PROPERTY_COUNT>;
 
   // Helper function to convert a vector of SMARTS to a vector of RDKit
   // molecules
-  std::vector<RDKit::RWMol> smarts2mols(std::vector<std::string> smarts);
+  static std::vector<RDKit::RWMol>
+  smarts2mols(const std::vector<std::string> &smarts);
   //  Asymmetric Double Sigmoidal (ADS) function parameters used to model the
   //  histogram. Parameters provided by the paper (see top of file)
-  std::unordered_map<std::string, ADSparameter> adsParameters = {
-      {"MW",
-       {2.817065973, 392.5754953, 290.7489764, 2.419764353, 49.22325677,
-        65.37051707, 104.9805561}},
-      {"ALOGP",
-       {3.172690585, 137.8624751, 2.534937431, 4.581497897, 0.822739154,
-        0.576295591, 131.3186604}},
-      {"HBA",
-       {2.948620388, 160.4605972, 3.615294657, 4.435986202, 0.290141953,
-        1.300669958, 148.7763046}},
-      {"HBD",
-       {1.618662227, 1010.051101, 0.985094388, 0.000000001, 0.713820843,
-        0.920922555, 258.1632616}},
-      {"PSA",
-       {1.876861559, 125.2232657, 62.90773554, 87.83366614, 12.01999824,
-        28.51324732, 104.5686167}},
-      {"ROTB",
-       {0.010000000, 272.4121427, 2.558379970, 1.565547684, 1.271567166,
-        2.758063707, 105.4420403}},
-      {"AROM",
-       {3.217788970, 957.7374108, 2.274627939, 0.000000001, 1.317690384,
-        0.375760881, 312.3372610}},
-      {"ALERTS",
-       {0.010000000, 1199.094025, -0.09002883, 0.000000001, 0.185904477,
-        0.875193782, 417.7253140}}};
+  static constexpr ADSparameter adsParameters[PROPERTY_COUNT] = {
+      // MW
+      {2.817065973, 392.5754953, 290.7489764, 2.419764353, 49.22325677,
+       65.37051707, 104.9805561},
+      // ALOGP
+      {3.172690585, 137.8624751, 2.534937431, 4.581497897, 0.822739154,
+       0.576295591, 131.3186604},
+      // HBA
+      {2.948620388, 160.4605972, 3.615294657, 4.435986202, 0.290141953,
+       1.300669958, 148.7763046},
+      // HBD
+      {1.618662227, 1010.051101, 0.985094388, 0.000000001, 0.713820843,
+       0.920922555, 258.1632616},
+      // PSA
+      {1.876861559, 125.2232657, 62.90773554, 87.83366614, 12.01999824,
+       28.51324732, 104.5686167},
+      // ROTB
+      {0.010000000, 272.4121427, 2.558379970, 1.565547684, 1.271567166,
+       2.758063707, 105.4420403},
+      // AROM
+      {3.217788970, 957.7374108, 2.274627939, 0.000000001, 1.317690384,
+       0.375760881, 312.3372610},
+      // ALERTS
+      {0.010000000, 1199.094025, -0.09002883, 0.000000001, 0.185904477,
+       0.875193782, 417.7253140}};
+  // Store the RDKit molecule itself and not the pointer because using a pointer
+  // requires a pointer dereference on each iteration of the loop in
+  // calcProperties whereas storing the molecule itself in the vector should
+  // have the molecules contiguously in memory and better cache locality.
   std::vector<RDKit::RWMol> acceptorMols;
   std::vector<RDKit::RWMol> alertMols;
-  std::unique_ptr<RDKit::RWMol> aliphaticRingsMol;
-  std::string aliphaticRingSmarts = "[$([A;R][!a])]";
-  std::vector<std::string> acceptorSmarts = {"[oH0;X2]",
-                                             "[OH1;X2;v2]",
-                                             "[OH0;X2;v2]",
-                                             "[OH0;X1;v2]",
-                                             "[O-;X1]",
-                                             "[SH0;X2;v2]",
-                                             "[SH0;X1;v2]",
-                                             "[S-;X1]",
-                                             "[nH0;X2]",
-                                             "[NH0;X1;v3]",
-                                             "[$([N;+0;X3;v3]);!$(N[C,S]=O)]"};
+  RDKit::RWMol aliphaticRingsMol;
+  static constexpr const char *aliphaticRingSmarts = "[$([A;R][!a])]";
+  static const std::vector<std::string> &acceptorSmarts() {
+    static const std::vector<std::string> smarts = {
+        "[oH0;X2]",    "[OH1;X2;v2]", "[OH0;X2;v2]",
+        "[OH0;X1;v2]", "[O-;X1]",     "[SH0;X2;v2]",
+        "[SH0;X1;v2]", "[S-;X1]",     "[nH0;X2]",
+        "[NH0;X1;v3]", "[$([N;+0;X3;v3]);!$(N[C,S]=O)]"};
+    return smarts;
+  }
   // clang-format off
-  std::vector<std::string> structuralAlertSmarts = {
+  static const std::vector<std::string> &structuralAlertSmarts() {
+    static const std::vector<std::string> smarts = {
  "*1[O,S,N]*1", "[S,C](=[O,S])[F,Br,Cl,I]", "[CX4][Cl,Br,I]", "[#6]S(=O)(=O)O[#6]",
   "[$([CH]),$(CC)]#CC(=O)[#6]", "[$([CH]),$(CC)]#CC(=O)O[#6]", "n[OH]",
   "[$([CH]),$(CC)]#CS(=O)(=O)[#6]", "C=C(C=O)C=O", "n1c([F,Cl,Br,I])cccc1", "[CH1](=O)", "[#8][#8]",
@@ -140,38 +158,25 @@ private:
   "c1nc([F,Cl,Br,I,S])ncc1", "c1ncnc([F,Cl,Br,I,S])c1", "c1nc(c2c(n1)nc(n2)[F,Cl,Br,I])",
   "[#6]S(=O)(=O)c1ccc(cc1)F", "[15N]", "[13C]", "[18O]", "[34S]"
   };
+    return smarts;
+  }
 
   // clang-format on
 
-  QEDproperties WEIGHT_MAX =
-      QEDproperties(0.50, 0.25, 0.00, 0.50, 0.00, 0.50, 0.25, 1.00);
   // currently only implemented with weight_mean
-  QEDproperties WEIGHT_MEAN =
-      QEDproperties(0.66, 0.46, 0.05, 0.61, 0.06, 0.65, 0.48, 0.95);
-  QEDproperties WEIGHT_NONE =
-      QEDproperties(1.00, 1.00, 1.00, 1.00, 1.00, 1.00, 1.00, 1.00);
-  // Compute the RDKit molecule object for aliphatic rings
-  std::unique_ptr<RDKit::RWMol> getAliphaticRingsMol();
-  // Note for getStructurealAlertMols and getAcceptorMols:
-  // Store the RDKit molecule itself and not the pointer because using a pointer
-  // requires a pointer dereference on each iteration of the loop in
-  // calcProperties whereas storing the molecule itself in the vector should
-  // have the molecules contiguously in memory and better cache locality.
-  // Also if using a unique_ptr, code working with the unique_ptr would need to
-  // handle ownership and make sure it is moved correctly in the loop.
-  //
-  // Compute the RDKit molecule objects for the structural alerts
-  std::vector<std::unique_ptr<RDKit::RWMol>> getStructuralAlertMols();
-  // Compute the RDKit molecule objects for hydrogen bond acceptors
-  std::vector<std::unique_ptr<RDKit::RWMol>> getAcceptorMols();
+  static constexpr float WEIGHT_MEAN[PROPERTY_COUNT] = {
+      0.66, 0.46, 0.05, 0.61, 0.06, 0.65, 0.48, 0.95};
+  // Count the aromatic rings: the rings that are left after the aliphatic
+  // ring atoms are removed
+  unsigned int calcAromaticRings(const RDKit::ROMol &mol,
+                                 Buffers &buffers) const;
   // Calculate the properties needed for the QED descriptor
-  QEDproperties calcProperties(const RDKit::ROMol &mol,
-                               std::vector<RDKit::RWMol> acceptorMols,
-                               std::unique_ptr<RDKit::RWMol> aliphaticRingMol,
-                               std::vector<RDKit::RWMol> alertMols);
+  QEDproperties calcProperties(const RDKit::ROMol &mol, double amw,
+                               double crippenLogP, unsigned int hbd,
+                               double psa, Buffers &buffers) const;
   // Compute the asymmetric double sigmoidal function using the value of the
   // descriptor of interest (the parameter `x` in the function) and the
   // adsParameters for that descriptor of interest
-  double calcADS(float x, std::string adsParameterKey);
+  static double calcADS(float x, Property property);
 };
 } // namespace duckdb
@@ -1,14 +1,20 @@
 #pragma once
+#include "duckdb/function/copy_function.hpp"
 #include "duckdb/function/function_set.hpp"
 #include "duckdb/function/replacement_scan.hpp"
+#include "duckdb/optimizer/optimizer_extension.hpp"
 namespace duckdb {
 
 class SDFFunctions {
 public:
   static vector<TableFunctionSet> GetTableFunctions();
+  //! COPY ... TO (FORMAT sdf)
+  static CopyFunction GetCopyFunction();
   static unique_ptr<TableRef>
   ReadSDFReplacement(ClientContext &context, ReplacementScanInput &input,
                      optional_ptr<ReplacementScanData> data);
+  //! Pushes an OFFSET into the scan of indexed SDF files
+  static OptimizerExtension GetOptimizerExtension();
 
 private:
   static TableFunctionSet GetReadSDFTableFunction();
@@ -0,0 +1,43 @@
+#pragma once
+#include "duckdb/common/file_system.hpp"
+#include "duckdb/common/vector.hpp"
+#include "duckdb/function/table_function.hpp"
+#include "duckdb/main/client_context.hpp"
+
+namespace duckdb {
+
+//! The start positions of the records of an SDF file, built by
+//! sdf_build_index and stored next to the file as <path>.idx. With it, the
+//! scan finds the record boundaries of its byte ranges without reading the
+//! file, and can start directly at a record for an OFFSET.
+//!
+//! The index file is a header (magic, size and last modified time of the
+//! SDF, record count), followed by the start positions as 64-bit integers.
+//! An index is ignored if the SDF has changed since it was built.
+struct SDFIndex {
+public:
+  static constexpr const char *FILE_EXTENSION = ".idx";
+
+  //! The start positions of the records, in order
+  vector<idx_t> record_offsets;
+
+public:
+  idx_t RecordCount() const { return record_offsets.size(); }
+  //! Returns the position of the first record that starts at or after pos,
+  //! the same as SDFScanLocalState::FindRecordStart
+  idx_t FindRecordStart(idx_t pos, idx_t file_size) const;
+
+  //! Loads the index of the SDF at path. Returns nullptr if there is no
+  //! index, or if it is out of date
+  static unique_ptr<SDFIndex> Load(ClientContext &context,
+                                   const string &path);
+  //! Scans the SDF at path and writes its index. Returns the number of
+  //! records
+  static idx_t Build(ClientContext &context, const string &path);
+};
+
+//! sdf_build_index(path): builds the index of each SDF file of a path, list
+//! or glob, and returns the number of records of each file
+TableFunctionSet GetSDFBuildIndexFunction();
+
+} // namespace duckdb
@@ -0,0 +1,106 @@
+#pragma once
+#include "duckdb/common/file_system.hpp"
+#include "duckdb/common/optional_ptr.hpp"
+#include "duckdb/common/vector.hpp"
+#include <cstring>
+#include <string>
+
+namespace duckdb {
+
+//! A part of the buffer of a SDFRecordReader. It is an offset and not a
+//! pointer, so that it stays valid when the buffer grows
+struct SDFSlice {
+  idx_t offset = 0;
+  idx_t size = 0;
+};
+
+//! A data item of a record: a "> <name>" line followed by the value lines
+struct SDFProperty {
+  SDFSlice name;
+  SDFSlice value;
+};
+
+//! A record of an SDF: the molblock, and the data items that follow it
+struct SDFRecord {
+  //! The header, counts line and atom/bond blocks up to and including M  END
+  SDFSlice molblock;
+  //! The data items of the record are properties[begin, end) of the reader
+  idx_t properties_begin = 0;
+  idx_t properties_end = 0;
+};
+
+//! Splits a byte range of an SDF file into records, without parsing the
+//! molecules. The file is read in large blocks into one buffer, and the
+//! records are returned as slices of that buffer, so no record, molblock or
+//! value is copied. The molblocks can then be parsed only for the records
+//! that need them.
+//!
+//! The data items are read the same way RDKit reads them: the name is
+//! between the first < and the last > of a line that starts with > after
+//! M  END, and the value is the lines up to the next blank line, joined with
+//! line breaks.
+class SDFRecordReader {
+public:
+  static constexpr idx_t BLOCK_SIZE = 1024 * 1024;
+
+  //! Starts reading the records in [start, end) of the file. start must be
+  //! the start of a record. A file that cannot seek, like a compressed file,
+  //! is read from its current position up to its end, and end only bounds
+  //! the number of bytes that are read
+  void Reset(FileHandle &handle, idx_t start, idx_t end);
+  //! Reads up to max_records records. The slices of the records are valid
+  //! until the next call to ReadRecords or Reset. Returns the number of
+  //! records, 0 if the range is done
+  idx_t ReadRecords(idx_t max_records);
+
+  const vector<SDFRecord> &GetRecords() const { return records; }
+  //! The data items of the records are GetProperty(properties_begin) up to
+  //! GetProperty(properties_end - 1)
+  const SDFProperty &GetProperty(idx_t idx) const { return properties[idx]; }
+  //! Finds the value of the data item with the given name in the record. If
+  //! there are several, the last one is used, as in RDKit
+  bool FindProperty(const SDFRecord &record, const string &name,
+                    SDFSlice &value) const;
+
+  //! The position of the start of the record in the file
+  idx_t GetFileOffset(const SDFRecord &record) const {
+    return buffer_offset + record.molblock.offset;
+  }
+
+  const char *GetData(const SDFSlice &slice) const {
+    return buffer.data() + slice.offset;
+  }
+  string GetString(const SDFSlice &slice) const {
+    return string(GetData(slice), slice.size);
+  }
+
+private:
+  //! Appends the next block of the range to the buffer. Returns false if the
+  //! whole range is read
+  bool ReadBlock();
+  //! Finds the end of the record at buffer_pos: the start of its $$$$ line,
+  //! and the start of the next record. Reads more blocks as needed. Returns
+  //! false if there are no more records
+  bool FindRecordEnd(idx_t &record_end, idx_t &next_record);
+  //! Splits the record in [start, end) into its molblock and data items
+  void ParseRecord(idx_t start, idx_t end);
+  //! Returns the end of the line that starts at pos, without the line break
+  //! (and without \r), and sets next_line to the start of the next line
+  idx_t LineEnd(idx_t pos, idx_t end, idx_t &next_line) const;
+
+  optional_ptr<FileHandle> handle;
+  //! The position in the file of the next block, and the end of the range
+  idx_t file_pos = 0;
+  idx_t range_end = 0;
+
+  std::string buffer;
+  //! The position in the file of the start of the buffer
+  idx_t buffer_offset = 0;
+  //! The start of the records that are not returned yet
+  idx_t buffer_pos = 0;
+
+  vector<SDFRecord> records;
+  vector<SDFProperty> properties;
+};
+
+} // namespace duckdb
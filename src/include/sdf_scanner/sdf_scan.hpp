@@ -1,11 +1,16 @@
 #pragma once
-#include "GraphMol/FileParsers/MolSupplier.h"
+#include "duckdb/common/atomic.hpp"
+#include "duckdb/common/file_system.hpp"
 #include "duckdb/common/multi_file/multi_file_reader.hpp"
 #include "duckdb/common/unique_ptr.hpp"
 #include "duckdb/execution/execution_context.hpp"
+#include "duckdb/execution/expression_executor.hpp"
 #include "duckdb/function/function.hpp"
 #include "duckdb/function/table_function.hpp"
 #include "duckdb/main/client_context.hpp"
+#include "mol_errors.hpp"
+#include "sdf_scanner/sdf_index.hpp"
+#include "sdf_scanner/sdf_reader.hpp"
 
 namespace duckdb {
 
@@ -19,6 +24,13 @@ public:
 
   //! The files we're reading
   vector<OpenFileInfo> files;
+  //! The index of each file that has an up to date one, built by
+  //! sdf_build_index, or nullptr
+  vector<unique_ptr<SDFIndex>> indexes;
+  //! The number of records at the start of the files that are skipped. An
+  //! OFFSET directly above the scan is turned into this when all files have
+  //! an index
+  idx_t skip_records = 0;
   //! All column names (in order) specified by the query for projection
   vector<string> names;
   //! All column types (in order) specified by the query for projection
@@ -34,38 +46,133 @@ public:
   //! A value of -1 means there is no mol_col_idx set because Mol type was
   //! not requested
   short mol_col_idx = -1;
+
+  //! The index of the column with the path of the file of each record, or -1
+  //! if the filename option is not set. Without the option, the path is the
+  //! filename virtual column, which is only read when the query uses it
+  short filename_col_idx = -1;
+  //! Combine the properties of all files into the schema in read_sdf_auto,
+  //! instead of taking the properties of the first file
+  bool union_by_name = false;
+  //! The number of records of each file that read_sdf_auto samples to find
+  //! the properties and their types. A negative number samples all records
+  int64_t sample_size = 1024;
+  //! Do not detect the types of the properties in read_sdf_auto, and read
+  //! all of them as VARCHAR
+  bool all_varchar = false;
+  //! Whether the types were detected from a sample of the records by
+  //! read_sdf_auto, instead of given by the query
+  bool detected_types = false;
+
+  //! The filters of the query that only use property columns (and the
+  //! filename column), combined with AND. They are evaluated on the text of
+  //! the properties before the molblocks are parsed. The column references
+  //! are replaced with references into a chunk of the filter_column_ids
+  //! columns, or nullptr if there are no such filters
+  unique_ptr<Expression> filter;
+  //! The columns used by the filter, indexes into names
+  vector<column_t> filter_column_ids;
+  //! The types of the filter columns
+  vector<LogicalType> filter_types;
+
+  //! The column ids of the projection can also be the row id, which is
+  //! column_t(-1), the same as an unset mol_col_idx or filename_col_idx
+  bool IsMolColumn(column_t column_id) const {
+    return mol_col_idx >= 0 && column_id == column_t(mol_col_idx);
+  }
+  bool IsFilenameColumn(column_t column_id) const {
+    return column_id == MultiFileReader::COLUMN_IDENTIFIER_FILENAME ||
+           (filename_col_idx >= 0 && column_id == column_t(filename_col_idx));
+  }
+  //! Whether the column is a property, the Mol or the filename column, and
+  //! not the row id or the empty column of count(*)
+  bool HasColumn(column_t column_id) const {
+    return column_id < names.size() || IsFilenameColumn(column_id);
+  }
+  //! Whether all files have an index, so that the number of records is known
+  bool AllFilesIndexed() const {
+    for (auto &index : indexes) {
+      if (!index) {
+        return false;
+      }
+    }
+    return true;
+  }
 };
 
+//! The SDF files are split into byte ranges that are scanned in parallel.
+//! The boundaries of a range are moved forward to the start of the next
+//! record, the line after a $$$$ delimiter, so every record is scanned by
+//! exactly one range. The ranges are numbered through all files in order, so
+//! the threads work on several files at the same time.
 struct SDFScanGlobalState {
 public:
   SDFScanGlobalState(ClientContext &context, const SDFScanData &bind_data);
 
+  //! The size of the byte ranges
+  static constexpr idx_t RANGE_SIZE = 8 * 1024 * 1024;
+
 public:
   //! Bound data
   const SDFScanData &bind_data;
-  unique_ptr<RDKit::v2::FileParsers::SDMolSupplier> mol_supplier;
-  //! the number of records in the SDF file
-  idx_t length;
-  //! The record number of the last record we have scanned in the SDF file;
-  //! where we are in the SDF
-  idx_t offset;
-
-  //! Column names that we're actually reading (after projection pushdown)
-  vector<string> names;
+  //! The size of each file in bytes
+  vector<idx_t> file_sizes;
+  //! Whether each file can be split into ranges. Compressed files cannot
+  //! seek, and are read as a single range
+  vector<bool> file_seekable;
+  //! The position in each file where the scan starts, after the skipped
+  //! records
+  vector<idx_t> file_starts;
+  //! The number of the first range of each file
+  vector<idx_t> file_first_range;
+  //! The number of byte ranges of all files
+  idx_t range_count;
+  //! The size of all files in bytes
+  idx_t total_size;
+  //! The next range that has not been claimed by a thread
+  atomic<idx_t> next_range;
+  //! The number of bytes of the ranges that are done, for the progress
+  atomic<idx_t> bytes_scanned;
+
+  //! The columns that are read, indexes into the names of the bind data
+  //! (after projection pushdown)
+  vector<column_t> column_ids;
+  //! Whether the Mol column is read. If it is not, the molblocks are not
+  //! parsed at all
+  bool read_mol;
 };
 
 struct SDFScanLocalState {
 public:
   SDFScanLocalState(ClientContext &context, SDFScanGlobalState &gstate);
 
+  ClientContext &context;
+
 public:
-  //! Retrieves the next chunk of SDF records from the global state
-  //! and populates the local state with its properties.
-  //! If a molecule is available, its properties are extracted and stored in
-  //! the local state. The number of records scanned is also incremented
-  //! accordingly, and stored in the local state.
+  //! Reads the next records of the range from the global state, and writes
+  //! the projected columns of the records that pass the filter directly into
+  //! the vectors of the output chunk. The number of records that are
+  //! returned is stored in scan_count
   void ExtractNextChunk(SDFScanGlobalState &gstate, SDFScanLocalState &lstate,
-                        SDFScanData &bind_data);
+                        const SDFScanData &bind_data, DataChunk &output);
+  //! Claims the next byte range of the file. Returns false if all ranges are
+  //! claimed
+  bool NextRange(SDFScanGlobalState &gstate);
+  //! Returns the position of the first record that starts at or after pos
+  static idx_t FindRecordStart(FileHandle &handle, idx_t pos,
+                               idx_t file_size);
+  //! Evaluates the filter of the bind data on the properties of the records
+  //! that were read, and sets filter_sel to the records that pass. Returns
+  //! the number of records that pass
+  idx_t FilterRecords(idx_t record_count);
+  //! Sets text to the values of a property column of the records in sel, as
+  //! slices of the reader buffer. Missing and empty values are NULL
+  void ReadPropertyText(column_t column_id, const SelectionVector &sel,
+                        idx_t count, Vector &text);
+  //! Casts the text of a property column to the type of the column. Throws
+  //! an error that names the column if a value cannot be cast
+  void CastPropertyText(column_t column_id, Vector &text, Vector &result,
+                        idx_t count);
 
 public:
   //! The number of records successfully scanned from the SDF.
@@ -73,14 +180,38 @@ public:
   //! returned by the scanning function. If this value is zero, duckdb will then
   //! know to not call the function again. That will end the scan.
   idx_t scan_count;
-
-  //! The properties for each record in the current chunk of records being
-  //! scanned. Each record is a "row", each property is a "column". The outer
-  //! vector is a vector of "rows" (the inner vector). Each entry in the inner
-  //! vector is a "column", or property extracted from the SDF fields
-  vector<vector<string>> rows;
+  //! The range that is being scanned. The records of one output chunk are
+  //! all from the same range, so the range is the batch index of the chunk,
+  //! which keeps the insertion order.
+  idx_t range_idx;
 
 private:
+  //! The file of the range that is being scanned
+  idx_t file_idx;
+  unique_ptr<FileHandle> file_handle;
+  //! Splits the range that is being scanned into records
+  SDFRecordReader reader;
+  idx_t range_size = 0;
+  bool has_range = false;
+
+  //! Evaluates the filter of the bind data, if there is one
+  unique_ptr<ExpressionExecutor> filter_executor;
+  //! The text of the filter columns, as slices of the reader buffer
+  DataChunk filter_text;
+  //! The filter columns, cast to their types
+  DataChunk filter_chunk;
+  //! The records of the chunk that pass the filter
+  SelectionVector filter_sel;
+  //! The text of a property column of the returned records, which is copied
+  //! or cast into the output
+  Vector property_text;
+  //! The molblocks of the chunk that could not be parsed, reported to the
+  //! error state of the connection once per chunk
+  vector<MolError> mol_errors;
+  shared_ptr<MolErrorState> error_state;
+  //! the molblock errors are only reported through mol_errors
+  RDKitLogBlocker log_blocker;
+
   //! Bind data
   const SDFScanData &bind_data;
 };
@@ -92,6 +223,10 @@ public:
   static unique_ptr<GlobalTableFunctionState>
   Init(ClientContext &context, TableFunctionInitInput &input);
 
+  idx_t MaxThreads() const override {
+    return MaxValue<idx_t>(1, state.range_count);
+  }
+
 public:
   SDFScanGlobalState state;
 };
@@ -110,16 +245,45 @@ public:
 
 struct SDFScan {
 public:
-  //! Scans the first record of the SDF and assumes that the properties in the
-  //! first are the same for all records. Fills the bind_data names,
-  //! return_types, and types fields with these properties for the reading
-  //! function for projection
+  //! Samples records from several places of the first SDF, and uses every
+  //! property of the sampled records as a column. The type of a column is
+  //! the most specific of BOOLEAN, BIGINT, DOUBLE and VARCHAR that all its
+  //! sampled values can be cast to. Fills the bind_data names, return_types,
+  //! and types fields for the reading function for projection. With
+  //! union_by_name, every file is sampled, and the properties of all of them
+  //! are combined
   static void AutoDetect(ClientContext &context, SDFScanData &bind_data,
                          vector<LogicalType> &return_types,
                          vector<string> &names);
   static double ScanProgress(ClientContext &context,
                              const FunctionData *bind_data_p,
                              const GlobalTableFunctionState *global_state);
+  //! Opens an SDF file for reading. Files ending in .gz or .zst are
+  //! decompressed as a stream by the DuckDB file system
+  static unique_ptr<FileHandle> OpenFile(ClientContext &context,
+                                         const string &path);
+  //! The filename virtual column, the same as the one of the DuckDB file
+  //! readers, and the empty column that count(*) reads
+  static virtual_column_map_t
+  GetVirtualColumns(ClientContext &context,
+                    optional_ptr<FunctionData> bind_data);
+  //! Adds the column of the filename option to the schema
+  static void AddFilenameColumn(const string &column_name,
+                                SDFScanData &bind_data,
+                                vector<LogicalType> &return_types,
+                                vector<string> &names);
+  static OperatorPartitionData
+  GetPartitionData(ClientContext &context,
+                   TableFunctionGetPartitionInput &input);
+  //! The number of records, if all files have an index
+  static unique_ptr<NodeStatistics> Cardinality(ClientContext &context,
+                                                const FunctionData *bind_data);
+  //! Takes the filters that only use property columns out of the plan, so
+  //! that they are evaluated in the scan before the molecules are parsed.
+  //! Filters on the Mol column stay in the plan
+  static void PushdownComplexFilter(ClientContext &context, LogicalGet &get,
+                                    FunctionData *bind_data,
+                                    vector<unique_ptr<Expression>> &filters);
 };
 
 } // namespace duckdb
@@ -0,0 +1,17 @@
+#pragma once
+#include "duckdb/function/copy_function.hpp"
+
+namespace duckdb {
+
+//! COPY ... TO 'file.sdf' (FORMAT sdf): writes each row as an SDF record.
+//! The first Mol column is written as the molblock of the record, and the
+//! other columns as "> <name>" data items, as text. NULL values are left
+//! out of the record, and a NULL molecule is written as an empty molblock.
+//!
+//! The molblocks are generated by all threads in parallel. The order of the
+//! rows is kept the same way the CSV writer keeps it: each batch of rows is
+//! written into a buffer in parallel, and the buffers are appended to the
+//! file in the order of the batches.
+CopyFunction GetSDFCopyFunction();
+
+} // namespace duckdb
@@ -0,0 +1,10 @@
+#pragma once
+#include "common.hpp"
+
+namespace duckdb {
+// Quotes a table name, which may be qualified with a schema and catalog, for
+// the table functions that are rewritten to a query over the table
+std::string table_to_sql(const std::string &table_name);
+
+void RegisterSimilaritySearchFunctions(ExtensionLoader &loader);
+} // namespace duckdb
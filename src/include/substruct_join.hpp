@@ -0,0 +1,6 @@
+#pragma once
+#include "common.hpp"
+
+namespace duckdb {
+void RegisterSubstructJoinFunctions(ExtensionLoader &loader);
+} // namespace duckdb
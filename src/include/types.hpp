@@ -4,5 +4,6 @@
 namespace duckdb {
 
 LogicalType Mol();
+LogicalType BitFP();
 void RegisterTypes(ExtensionLoader &loader);
 } // namespace duckdb
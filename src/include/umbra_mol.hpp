@@ -13,11 +13,23 @@
 namespace duckdb {
 
 // This is to generate the prefix and concatenate it with the binary RDKit
-// molecule so that it can then be sent to a string_t. Return the std::string
+// molecule and its canonical SMILES so that it can then be sent to a string_t. Return the std::string
 // because later the StringVector::AddStringOrBlob function takes a std::string,
 // not string_t.
 std::string get_umbra_mol_string(const RDKit::ROMol &mol);
 
+// The canonical hash of a molecule: a 64-bit hash of its canonical SMILES
+// without stereo and isotopes, the SMILES that mol_cmp compares. Molecules
+// that is_exact_match finds equal have the same hash. The hash is stored with
+// the molecule, so it must not change between versions
+uint64_t make_mol_hash(const RDKit::ROMol &mol);
+
+// The version of the canonical hash: the RDKit release the extension is built
+// with, as YYYYMMPP (e.g. 20240906 for 2024.09.6). The canonical SMILES, and
+// so the hash, can change between RDKit releases. Stored hashes are only
+// compared to hashes of the same version
+uint32_t mol_hash_version();
+
 struct umbra_mol_t {
   // Use composition to add methods to the string_t
   // the umbra_mol is just a string_t under the hood.
@@ -34,6 +46,23 @@ struct umbra_mol_t {
   // class And the remaining 4 bytes are in the beginning of the "string"
   // pointed to by the pointer in string_t
   static constexpr idx_t DALKE_FP_PREFIX_BYTES = 8 * sizeof(char);
+  // the 55 bits of the dalke fp in the first 8 bytes. The highest bits are
+  // not used by the fp, and flag the optional sections of the umbra_mol
+  static constexpr uint64_t DALKE_FP_MASK = (uint64_t(1) << 55) - 1;
+  // The umbra_mol ends with the canonical SMILES of the molecule, followed by
+  // its size as 4 bytes, so that converting the molecule to SMILES is a copy.
+  // Molecules stored before the SMILES section was added do not have it
+  static constexpr uint64_t HAS_SMILES_FLAG = uint64_t(1) << 63;
+  static constexpr idx_t SMILES_SIZE_BYTES = sizeof(uint32_t);
+  // The header is followed by the canonical hash of the molecule (see
+  // make_mol_hash), so that exact matches, DISTINCT and GROUP BY on molecules
+  // compare hashes before molecules. The hash is followed by its version (see
+  // mol_hash_version). Molecules stored before the hash was added do not have
+  // it
+  static constexpr uint64_t HAS_HASH_FLAG = uint64_t(1) << 62;
+  static constexpr idx_t HASH_BYTES = sizeof(uint64_t);
+  static constexpr idx_t HASH_VERSION_BYTES = sizeof(uint32_t);
+  static constexpr idx_t HASH_SECTION_BYTES = HASH_BYTES + HASH_VERSION_BYTES;
   static constexpr idx_t MAX_STRING_SIZE = NumericLimits<uint32_t>::Maximum();
   static constexpr idx_t PREFIX_BYTES = string_t::PREFIX_BYTES;
 
@@ -72,10 +101,56 @@ struct umbra_mol_t {
   //   D_ASSERT(value.ptr == buffer.GetData());
   // }
 
-  uint64_t GetDalkeFP() {
-    uint64_t int_fp = 0;
-    std::memcpy(&int_fp, string_t_umbra_mol.GetData(), DALKE_FP_PREFIX_BYTES);
-    return int_fp;
+  // The first 8 bytes: the dalke fp and the flags
+  uint64_t GetHeader() const {
+    uint64_t header = 0;
+    std::memcpy(&header, string_t_umbra_mol.GetData(), DALKE_FP_PREFIX_BYTES);
+    return header;
+  }
+
+  uint64_t GetDalkeFP() const { return GetHeader() & DALKE_FP_MASK; }
+
+  bool HasSmiles() const { return GetHeader() & HAS_SMILES_FLAG; }
+
+  bool HasHash() const { return GetHeader() & HAS_HASH_FLAG; }
+
+  // The canonical hash stored in the umbra_mol. Only valid if HasHash()
+  uint64_t GetHash() const {
+    D_ASSERT(HasHash());
+    return Load<uint64_t>(
+        const_data_ptr_cast(GetData() + DALKE_FP_PREFIX_BYTES));
+  }
+
+  // The version of the stored hash. Only valid if HasHash()
+  uint32_t GetHashVersion() const {
+    D_ASSERT(HasHash());
+    return Load<uint32_t>(
+        const_data_ptr_cast(GetData() + DALKE_FP_PREFIX_BYTES + HASH_BYTES));
+  }
+
+  // Whether the stored hash can be compared to hashes computed by this build.
+  // Hashes stored by another RDKit release must be computed again
+  bool HasCurrentHash() const {
+    return HasHash() && GetHashVersion() == mol_hash_version();
+  }
+
+  // The size of the SMILES section, including its size. 0 if there is none
+  uint32_t GetSmilesSectionSize() const {
+    if (!HasSmiles()) {
+      return 0;
+    }
+    return SMILES_SIZE_BYTES + Load<uint32_t>(const_data_ptr_cast(
+                                   GetData() + GetSize() - SMILES_SIZE_BYTES));
+  }
+
+  // The canonical SMILES stored in the umbra_mol. Only valid if HasSmiles().
+  // This does not copy anything, the data is only valid as long as the
+  // string_t is.
+  string_t GetSmiles() const {
+    auto section_size = GetSmilesSectionSize();
+    D_ASSERT(section_size >= SMILES_SIZE_BYTES);
+    return string_t(GetData() + GetSize() - section_size,
+                    section_size - SMILES_SIZE_BYTES);
   }
 
   // Return the prefix as a 4 byte int
@@ -87,20 +162,20 @@ struct umbra_mol_t {
 
   const char *GetPrefix() { return string_t_umbra_mol.GetPrefix(); }
 
-  uint32_t GetBinaryMolSize() {
-    return string_t_umbra_mol.GetSize() - DALKE_FP_PREFIX_BYTES;
+  // The position of the binary RDKit molecule, after the header and the hash
+  idx_t GetBinaryMolOffset() const {
+    return DALKE_FP_PREFIX_BYTES + (HasHash() ? HASH_SECTION_BYTES : 0);
   }
 
-  std::string GetBinaryMol() {
-    idx_t bmol_size = string_t_umbra_mol.GetSize() - DALKE_FP_PREFIX_BYTES;
-    std::string buffer;
-    buffer.resize(bmol_size);
-    if (string_t_umbra_mol.GetData() &&
-        string_t_umbra_mol.GetSize() > DALKE_FP_PREFIX_BYTES) {
-      memcpy(&buffer[0], &string_t_umbra_mol.GetData()[DALKE_FP_PREFIX_BYTES],
-             bmol_size);
-    }
-    return buffer;
+  uint32_t GetBinaryMolSize() const {
+    return string_t_umbra_mol.GetSize() - GetBinaryMolOffset() -
+           GetSmilesSectionSize();
+  }
+
+  // Pointer to the binary RDKit molecule inside the string_t. This does not
+  // copy anything, the data is only valid as long as the string_t is.
+  const char *GetBinaryMolData() const {
+    return string_t_umbra_mol.GetData() + GetBinaryMolOffset();
   }
 
   idx_t GetSize() const { return string_t_umbra_mol.GetSize(); }
@@ -0,0 +1,153 @@
+#include "mol_cache.hpp"
+#include "common.hpp"
+#include "duckdb/common/mutex.hpp"
+#include "duckdb/common/types/hash.hpp"
+#include "duckdb/function/table_function.hpp"
+#include "duckdb/main/client_context.hpp"
+#include "duckdb/main/client_context_state.hpp"
+#include "duckdb/transaction/meta_transaction.hpp"
+#include "mol_formats.hpp"
+#include <cstring>
+
+namespace duckdb {
+
+static_assert((DecodedMolCache::CAPACITY & (DecodedMolCache::CAPACITY - 1)) ==
+                  0,
+              "The capacity of the molecule cache must be a power of 2");
+static_assert(DecodedMolCache::CAPACITY % DecodedMolCache::WAYS == 0,
+              "The molecule cache must hold a whole number of sets");
+
+std::atomic<idx_t> DecodedMolCache::total_hits{0};
+std::atomic<idx_t> DecodedMolCache::total_misses{0};
+
+// Owns the molecule caches of the threads of the running query, so that the
+// cached molecules are released when the query ends
+class MolCacheState : public ClientContextState {
+public:
+  static shared_ptr<MolCacheState> Get(ClientContext &context) {
+    return context.registered_state->GetOrCreate<MolCacheState>(
+        "duckdb_rdkit_mol_cache");
+  }
+
+  void QueryEnd(ClientContext &) override {
+    vector<std::shared_ptr<DecodedMolCache>> released;
+    {
+      lock_guard<mutex> guard(lock);
+      released = std::move(caches);
+      caches.clear();
+    }
+  }
+
+  void Add(std::shared_ptr<DecodedMolCache> cache) {
+    lock_guard<mutex> guard(lock);
+    caches.push_back(std::move(cache));
+  }
+
+private:
+  mutex lock;
+  vector<std::shared_ptr<DecodedMolCache>> caches;
+};
+
+DecodedMolCache::DecodedMolCache(ClientContext &context,
+                                 transaction_t query_id)
+    : entries(CAPACITY), context(context), query_id(query_id) {}
+
+DecodedMolCache::~DecodedMolCache() {
+  total_hits.fetch_add(hits, std::memory_order_relaxed);
+  total_misses.fetch_add(misses, std::memory_order_relaxed);
+}
+
+DecodedMolCache &DecodedMolCache::Get(ExpressionState &state) {
+  // the cache of the thread, it expires when its query ends
+  static thread_local std::weak_ptr<DecodedMolCache> current;
+
+  auto &context = state.GetContext();
+  auto query_id = context.ActiveTransaction().GetActiveQuery();
+  auto cache = current.lock();
+  if (cache && &cache->context == &context && cache->query_id == query_id) {
+    return *cache;
+  }
+  cache = std::make_shared<DecodedMolCache>(context, query_id);
+  current = cache;
+  MolCacheState::Get(context)->Add(cache);
+  // the connection keeps the cache until the query ends
+  return *cache;
+}
+
+std::shared_ptr<const RDKit::ROMol>
+DecodedMolCache::GetMol(umbra_mol_t umbra_mol) {
+  auto data = umbra_mol.GetData();
+  auto size = umbra_mol.GetSize();
+  lookups++;
+
+  // the set is chosen by the address, the content is only read to confirm a
+  // match of the address and size
+  auto set = Hash<uint64_t>(reinterpret_cast<uintptr_t>(data)) &
+             (CAPACITY - 1) & ~(WAYS - 1);
+  auto *oldest = &entries[set];
+  for (idx_t i = set; i < set + WAYS; i++) {
+    auto &entry = entries[i];
+    if (entry.mol && entry.data == data && entry.bytes.size() == size &&
+        memcmp(entry.bytes.data(), data, size) == 0) {
+      hits++;
+      entry.last_use = lookups;
+      return entry.mol;
+    }
+    if (entry.last_use < oldest->last_use) {
+      oldest = &entry;
+    }
+  }
+
+  misses++;
+  std::shared_ptr<const RDKit::ROMol> mol(rdkit_umbra_mol_to_mol(umbra_mol));
+  oldest->data = data;
+  // reuses the buffer of the evicted entry
+  oldest->bytes.assign(data, size);
+  oldest->last_use = lookups;
+  oldest->mol = mol;
+  return mol;
+}
+
+//===--------------------------------------------------------------------===//
+// rdkit_mol_cache_stats()
+//===--------------------------------------------------------------------===//
+struct MolCacheStatsData : public GlobalTableFunctionState {
+  bool finished = false;
+};
+
+static unique_ptr<FunctionData>
+MolCacheStatsBind(ClientContext &context, TableFunctionBindInput &input,
+                  vector<LogicalType> &return_types, vector<string> &names) {
+  names.emplace_back("hits");
+  return_types.emplace_back(LogicalType::UBIGINT);
+  names.emplace_back("misses");
+  return_types.emplace_back(LogicalType::UBIGINT);
+  return nullptr;
+}
+
+static unique_ptr<GlobalTableFunctionState>
+MolCacheStatsInit(ClientContext &context, TableFunctionInitInput &input) {
+  return make_uniq<MolCacheStatsData>();
+}
+
+static void MolCacheStatsFunction(ClientContext &context,
+                                  TableFunctionInput &data_p,
+                                  DataChunk &output) {
+  auto &data = data_p.global_state->Cast<MolCacheStatsData>();
+  if (data.finished) {
+    return;
+  }
+  output.SetValue(0, 0, Value::UBIGINT(DecodedMolCache::total_hits.load()));
+  output.SetValue(1, 0, Value::UBIGINT(DecodedMolCache::total_misses.load()));
+  output.SetCardinality(1);
+  data.finished = true;
+}
+
+void RegisterMolCacheFunctions(ExtensionLoader &loader) {
+  TableFunction mol_cache_stats("rdkit_mol_cache_stats", {},
+                                MolCacheStatsFunction, MolCacheStatsBind,
+                                MolCacheStatsInit);
+  loader.RegisterFunction(mol_cache_stats);
+}
+
+} // namespace duckdb
@@ -1,7 +1,19 @@
+#include "mol_compare.hpp"
 #include "common.hpp"
 #include "duckdb/common/types/vector.hpp"
+#include "duckdb/execution/expression_executor.hpp"
 #include "duckdb/execution/expression_executor_state.hpp"
 #include "duckdb/function/scalar_function.hpp"
+#include "duckdb/main/config.hpp"
+#include "duckdb/optimizer/optimizer_extension.hpp"
+#include "duckdb/planner/expression/bound_columnref_expression.hpp"
+#include "duckdb/planner/expression/bound_comparison_expression.hpp"
+#include "duckdb/planner/expression/bound_conjunction_expression.hpp"
+#include "duckdb/planner/expression/bound_function_expression.hpp"
+#include "duckdb/planner/expression_iterator.hpp"
+#include "duckdb/planner/operator/logical_any_join.hpp"
+#include "duckdb/planner/operator/logical_filter.hpp"
+#include "mol_cache.hpp"
 #include "mol_formats.hpp"
 #include "types.hpp"
 #include "umbra_mol.hpp"
@@ -15,18 +27,32 @@
 
 namespace duckdb {
 
+CompiledQueryMol::CompiledQueryMol(string_t &umbra_mol_blob) {
+  auto query = umbra_mol_t(umbra_mol_blob);
+  mol = rdkit_umbra_mol_to_mol(query);
+  prefix = query.GetPrefixAsInt();
+  dalke_fp = query.GetDalkeFP();
+  smiles = RDKit::MolToSmiles(*mol, false);
+  hash = query.HasCurrentHash() ? query.GetHash() : make_mol_hash(*mol);
+  umbra_mol = query.GetString();
+}
+
+bool CompiledQueryMol::Matches(const string_t &umbra_mol_blob) const {
+  return umbra_mol_blob.GetSize() == umbra_mol.size() &&
+         memcmp(umbra_mol_blob.GetData(), umbra_mol.data(),
+                umbra_mol.size()) == 0;
+}
+
 // credit: code is from chemicalite
 // https://github.com/rvianello/chemicalite
 // See mol_search.test for an example of
 // a molecule which can return false negative, if the SMILES is different from
 // the query
-bool mol_cmp(std::string m1_bmol, std::string m2_bmol) {
-  std::unique_ptr<RDKit::ROMol> m1(new RDKit::ROMol());
-  std::unique_ptr<RDKit::ROMol> m2(new RDKit::ROMol());
-
-  RDKit::MolPickler::molFromPickle(m1_bmol, *m1);
-  RDKit::MolPickler::molFromPickle(m2_bmol, *m2);
-
+//
+// m2_smiles is the SMILES of m2 (without chirality). It is passed in so that
+// it can be computed once for a constant query molecule
+bool mol_cmp(const RDKit::ROMol &m1, const RDKit::ROMol &m2,
+             const std::string &m2_smiles) {
   // credit: code is from chemicalite
   // https://github.com/rvianello/chemicalite
   // See mol_search.test for an example of
@@ -36,9 +62,9 @@ bool mol_cmp(std::string m1_bmol, std::string m2_bmol) {
   RDKit::MatchVectType matchVect;
   bool recursion_possible = false;
   bool do_chiral_match = false; /* FIXME: make configurable getDoChiralSSS(); */
-  bool ss1 = RDKit::SubstructMatch(*m1, *m2, matchVect, recursion_possible,
+  bool ss1 = RDKit::SubstructMatch(m1, m2, matchVect, recursion_possible,
                                    do_chiral_match);
-  bool ss2 = RDKit::SubstructMatch(*m2, *m1, matchVect, recursion_possible,
+  bool ss2 = RDKit::SubstructMatch(m2, m1, matchVect, recursion_possible,
                                    do_chiral_match);
   if (ss1 && !ss2) {
     return false;
@@ -47,9 +73,97 @@ bool mol_cmp(std::string m1_bmol, std::string m2_bmol) {
   }
 
   // the above can still fail in some chirality cases
-  std::string smi1 = RDKit::MolToSmiles(*m1, do_chiral_match);
-  std::string smi2 = RDKit::MolToSmiles(*m2, do_chiral_match);
-  return smi1 == smi2;
+  std::string smi1 = RDKit::MolToSmiles(m1, do_chiral_match);
+  return smi1 == m2_smiles;
+}
+
+bool mol_cmp(umbra_mol_t m1_umbra_mol, umbra_mol_t m2_umbra_mol,
+             DecodedMolCache &cache) {
+  auto m1 = cache.GetMol(m1_umbra_mol);
+  auto m2 = cache.GetMol(m2_umbra_mol);
+
+  return mol_cmp(*m1, *m2, RDKit::MolToSmiles(*m2, false));
+}
+
+// Bind data for the compare functions.
+//
+// If the query molecule (the right-hand side) is a constant, it is compiled
+// once here, and shared by all the threads executing the function.
+struct MolCompareBindData : public FunctionData {
+  explicit MolCompareBindData(shared_ptr<const CompiledQueryMol> query_p)
+      : query(std::move(query_p)) {}
+
+  // nullptr if the query is not a constant
+  shared_ptr<const CompiledQueryMol> query;
+
+  unique_ptr<FunctionData> Copy() const override {
+    return make_uniq<MolCompareBindData>(query);
+  }
+
+  bool Equals(const FunctionData &other_p) const override {
+    auto &other = other_p.Cast<MolCompareBindData>();
+    if (!query || !other.query) {
+      return !query && !other.query;
+    }
+    return query->umbra_mol == other.query->umbra_mol;
+  }
+};
+
+// The local state holds the query molecule that is used by the specialized
+// constant query loop. It starts out as the query compiled at bind time. If
+// the query could not be folded at bind time, but is still constant within a
+// chunk, it is compiled by the thread when it first sees it, and is reused
+// for the following chunks as long as the query stays the same.
+struct MolCompareLocalState : public FunctionLocalState {
+  explicit MolCompareLocalState(shared_ptr<const CompiledQueryMol> query_p)
+      : query(std::move(query_p)) {}
+
+  shared_ptr<const CompiledQueryMol> query;
+};
+
+static unique_ptr<FunctionData>
+MolCompareBind(ClientContext &context, ScalarFunction &bound_function,
+               vector<unique_ptr<Expression>> &arguments) {
+  D_ASSERT(arguments.size() == 2);
+  auto &query_expr = *arguments[1];
+  if (query_expr.HasParameter() || !query_expr.IsFoldable()) {
+    return make_uniq<MolCompareBindData>(nullptr);
+  }
+
+  // For example, the query 'c1ccccc1N' is a VARCHAR constant with a cast to
+  // Mol. Evaluating it runs the cast, and gives back the umbra_mol
+  auto query_value = ExpressionExecutor::EvaluateScalar(context, query_expr);
+  if (query_value.IsNull()) {
+    return make_uniq<MolCompareBindData>(nullptr);
+  }
+  auto query_blob = string_t(StringValue::Get(query_value));
+  return make_uniq<MolCompareBindData>(
+      make_shared_ptr<const CompiledQueryMol>(query_blob));
+}
+
+static unique_ptr<FunctionLocalState>
+MolCompareInitLocalState(ExpressionState &state,
+                         const BoundFunctionExpression &expr,
+                         FunctionData *bind_data) {
+  auto &info = bind_data->Cast<MolCompareBindData>();
+  return make_uniq<MolCompareLocalState>(info.query);
+}
+
+// Returns the compiled query molecule if the query is the same for every row
+// of the chunk, or nullptr if the query needs to be deserialized per row
+static const CompiledQueryMol *GetConstantQuery(ExpressionState &state,
+                                                Vector &query) {
+  if (query.GetVectorType() != VectorType::CONSTANT_VECTOR ||
+      ConstantVector::IsNull(query)) {
+    return nullptr;
+  }
+  auto &lstate =
+      ExecuteFunctionState::GetFunctionState(state)->Cast<MolCompareLocalState>();
+  auto &query_blob = ConstantVector::GetData<string_t>(query)[0];
+  if (!lstate.query || !lstate.query->Matches(query_blob)) {
+    lstate.query = make_shared_ptr<const CompiledQueryMol>(query_blob);
+  }
+  return lstate.query.get();
 }
 
 static void is_exact_match(DataChunk &args, ExpressionState &state,
@@ -58,6 +172,24 @@ static void is_exact_match(DataChunk &args, ExpressionState &state,
   // args.data[i] is a FLAT_VECTOR
   auto &left = args.data[0];
   auto &right = args.data[1];
+  auto &cache = DecodedMolCache::Get(state);
+
+  auto query = GetConstantQuery(state, right);
+  if (query) {
+    UnaryExecutor::Execute<string_t, bool>(
+        left, result, args.size(), [&](string_t left_umbra_blob) {
+          auto left = umbra_mol_t(left_umbra_blob);
+          if (left.GetPrefixAsInt() != query->prefix) {
+            return false;
+          }
+          if (left.HasCurrentHash() && left.GetHash() != query->hash) {
+            return false;
+          }
+          auto left_mol = cache.GetMol(left);
+          return mol_cmp(*left_mol, *query->mol, query->smiles);
+        });
+    return;
+  }
 
   BinaryExecutor::Execute<string_t, string_t, bool>(
       left, right, result, args.size(),
@@ -73,13 +205,156 @@ static void is_exact_match(DataChunk &args, ExpressionState &state,
                    umbra_mol_t::PREFIX_BYTES) != 0) {
           return false;
         };
+        // molecules with different canonical hashes are not the same
+        // molecule. Molecules stored without the hash, or with hashes of
+        // different RDKit releases, skip this check
+        if (left.HasHash() && right.HasHash() &&
+            left.GetHashVersion() == right.GetHashVersion() &&
+            left.GetHash() != right.GetHash()) {
+          return false;
+        }
 
         // otherwise, do the more extensive check with rdkit
-        return mol_cmp(left.GetBinaryMol(), right.GetBinaryMol());
+        return mol_cmp(left, right, cache);
+      });
+}
+
+// mol_hash(mol): the canonical hash of the molecule, the same for molecules
+// that is_exact_match finds equal. Use it to DISTINCT, GROUP BY or join on
+// molecules with a hash aggregate or a hash join
+static void mol_hash(DataChunk &args, ExpressionState &state, Vector &result) {
+  D_ASSERT(args.ColumnCount() == 1);
+  auto &cache = DecodedMolCache::Get(state);
+  UnaryExecutor::Execute<string_t, uint64_t>(
+      args.data[0], result, args.size(), [&](string_t umbra_mol_blob) {
+        auto umbra_mol = umbra_mol_t(umbra_mol_blob);
+        // hashes stored by another RDKit release are computed again, so that
+        // the hashes of all molecules can be compared
+        if (umbra_mol.HasCurrentHash()) {
+          return umbra_mol.GetHash();
+        }
+        return make_mol_hash(*cache.GetMol(umbra_mol));
       });
 }
 
-bool _is_substruct(umbra_mol_t target, umbra_mol_t query) {
+static ScalarFunction GetMolHashFunction() {
+  return ScalarFunction("mol_hash", {Mol()}, LogicalType::UBIGINT, mol_hash);
+}
+
+//===--------------------------------------------------------------------===//
+// Optimizer
+//===--------------------------------------------------------------------===//
+// The tables that an expression reads columns of
+static void GetReferencedTables(const Expression &expr,
+                                unordered_set<idx_t> &tables) {
+  if (expr.GetExpressionClass() == ExpressionClass::BOUND_COLUMN_REF) {
+    tables.insert(expr.Cast<BoundColumnRefExpression>().binding.table_index);
+  }
+  ExpressionIterator::EnumerateChildren(expr, [&](const Expression &child) {
+    GetReferencedTables(child, tables);
+  });
+}
+
+// Returns mol_hash(left) = mol_hash(right) if expr is is_exact_match(left,
+// right) on the molecules of two different sides of a join, or nullptr
+static unique_ptr<Expression> GetExactMatchHashCondition(Expression &expr) {
+  if (expr.GetExpressionClass() != ExpressionClass::BOUND_FUNCTION) {
+    return nullptr;
+  }
+  auto &func = expr.Cast<BoundFunctionExpression>();
+  if (func.function.name != "is_exact_match" || func.children.size() != 2) {
+    return nullptr;
+  }
+  unordered_set<idx_t> left_tables;
+  unordered_set<idx_t> right_tables;
+  GetReferencedTables(*func.children[0], left_tables);
+  GetReferencedTables(*func.children[1], right_tables);
+  // a constant query is handled by the function itself
+  if (left_tables.empty() || right_tables.empty()) {
+    return nullptr;
+  }
+  for (auto table : left_tables) {
+    if (right_tables.find(table) != right_tables.end()) {
+      return nullptr;
+    }
+  }
+
+  vector<unique_ptr<Expression>> left_args;
+  left_args.push_back(func.children[0]->Copy());
+  vector<unique_ptr<Expression>> right_args;
+  right_args.push_back(func.children[1]->Copy());
+  auto left_hash = make_uniq<BoundFunctionExpression>(
+      LogicalType::UBIGINT, GetMolHashFunction(), std::move(left_args),
+      nullptr);
+  auto right_hash = make_uniq<BoundFunctionExpression>(
+      LogicalType::UBIGINT, GetMolHashFunction(), std::move(right_args),
+      nullptr);
+  return make_uniq<BoundComparisonExpression>(ExpressionType::COMPARE_EQUAL,
+                                              std::move(left_hash),
+                                              std::move(right_hash));
+}
+
+// Adds the hash conditions of the is_exact_match calls that are conjuncts of
+// expr to conditions
+static void AddExactMatchHashConditions(
+    Expression &expr, vector<unique_ptr<Expression>> &conditions) {
+  if (expr.GetExpressionType() == ExpressionType::CONJUNCTION_AND) {
+    for (auto &child : expr.Cast<BoundConjunctionExpression>().children) {
+      AddExactMatchHashConditions(*child, conditions);
+    }
+    return;
+  }
+  auto condition = GetExactMatchHashCondition(expr);
+  if (condition) {
+    conditions.push_back(std::move(condition));
+  }
+}
+
+// A join on is_exact_match(a.m, b.m) is a nested loop join that compares
+// every pair of molecules. Molecules that are an exact match have the same
+// mol_hash, so mol_hash(a.m) = mol_hash(b.m) is added to the join condition.
+// The built in optimizers then plan a hash join on it, and is_exact_match
+// verifies the pairs that it returns.
+//
+// Only inner joins are rewritten. Their conditions are filters at this point,
+// and the filter pushdown turns an equality between the two sides into the
+// condition of a hash join.
+static void OptimizeExactMatchJoins(unique_ptr<LogicalOperator> &plan) {
+  if (plan->type == LogicalOperatorType::LOGICAL_FILTER) {
+    auto &filter = plan->Cast<LogicalFilter>();
+    vector<unique_ptr<Expression>> conditions;
+    for (auto &expr : filter.expressions) {
+      AddExactMatchHashConditions(*expr, conditions);
+    }
+    for (auto &condition : conditions) {
+      filter.expressions.push_back(std::move(condition));
+    }
+  } else if (plan->type == LogicalOperatorType::LOGICAL_ANY_JOIN) {
+    auto &join = plan->Cast<LogicalAnyJoin>();
+    vector<unique_ptr<Expression>> conditions;
+    if (join.join_type == JoinType::INNER) {
+      AddExactMatchHashConditions(*join.condition, conditions);
+    }
+    for (auto &condition : conditions) {
+      join.condition = make_uniq<BoundConjunctionExpression>(
+          ExpressionType::CONJUNCTION_AND, std::move(join.condition),
+          std::move(condition));
+    }
+  }
+  for (auto &child : plan->children) {
+    OptimizeExactMatchJoins(child);
+  }
+}
+
+// This runs before the built in optimizers, so that the join order optimizer
+// plans the join with the hash condition
+static void ExactMatchJoinPreOptimize(OptimizerExtensionInput &input,
+                                      unique_ptr<LogicalOperator> &plan) {
+  OptimizeExactMatchJoins(plan);
+}
+
+bool _is_substruct(umbra_mol_t target, umbra_mol_t query,
+                   DecodedMolCache &cache) {
   // if the fragment exists in the query but not in the target,
   // there is no way for a match. This only works in one direction
   //
@@ -109,11 +384,8 @@ bool _is_substruct(umbra_mol_t target, umbra_mol_t query) {
     if ((q_dalke_fp & t_dalke_fp) == q_dalke_fp) {
       // query might be substructure of the target -- run a substructure match
       // on the molecule objects
-      std::unique_ptr<RDKit::ROMol> left_mol(new RDKit::ROMol());
-      std::unique_ptr<RDKit::ROMol> right_mol(new RDKit::ROMol());
-
-      RDKit::MolPickler::molFromPickle(target.GetBinaryMol(), *left_mol);
-      RDKit::MolPickler::molFromPickle(query.GetBinaryMol(), *right_mol);
+      auto left_mol = cache.GetMol(target);
+      auto right_mol = cache.GetMol(query);
 
       // copied from chemicalite
       RDKit::MatchVectType matchVect;
@@ -127,12 +399,44 @@ bool _is_substruct(umbra_mol_t target, umbra_mol_t query) {
   return false;
 }
 
+// Same as above, but the query molecule is already deserialized
+bool _is_substruct(umbra_mol_t target, const CompiledQueryMol &query,
+                   DecodedMolCache &cache) {
+  auto t_prefix = target.GetPrefixAsInt();
+  if ((query.prefix & t_prefix) != query.prefix) {
+    return false;
+  }
+  auto t_dalke_fp = target.GetDalkeFP();
+  if ((query.dalke_fp & t_dalke_fp) != query.dalke_fp) {
+    return false;
+  }
+
+  auto target_mol = cache.GetMol(target);
+  RDKit::MatchVectType matchVect;
+  bool recursion_possible = true;
+  bool do_chiral_match = false; /* FIXME: make configurable getDoChiralSSS(); */
+  return RDKit::SubstructMatch(*target_mol, *query.mol, matchVect,
+                               recursion_possible, do_chiral_match);
+}
+
 static void is_substruct(DataChunk &args, ExpressionState &state,
                          Vector &result) {
   D_ASSERT(args.ColumnCount() == 2);
   // args.data[i] is a FLAT_VECTOR
   auto &left = args.data[0];
   auto &right = args.data[1];
+  auto &cache = DecodedMolCache::Get(state);
+
+  // The query is usually a constant, e.g. is_substruct(m, 'c1ccccc1N').
+  // Do not deserialize it again for every row
+  auto query = GetConstantQuery(state, right);
+  if (query) {
+    UnaryExecutor::Execute<string_t, bool>(
+        left, result, args.size(), [&](string_t left_umbra_blob) {
+          return _is_substruct(umbra_mol_t(left_umbra_blob), *query, cache);
+        });
+    return;
+  }
 
   BinaryExecutor::Execute<string_t, string_t, bool>(
       left, right, result, args.size(),
@@ -140,21 +444,34 @@ static void is_substruct(DataChunk &args, ExpressionState &state,
         auto left_umbra_mol = umbra_mol_t(left_umbra_blob);
         auto right_umbra_mol = umbra_mol_t(right_umbra_blob);
 
-        return _is_substruct(left_umbra_mol, right_umbra_mol);
+        return _is_substruct(left_umbra_mol, right_umbra_mol, cache);
       });
 }
 
 void RegisterCompareFunctions(ExtensionLoader &loader) {
   ScalarFunctionSet set("is_exact_match");
   // left type and right type
-  set.AddFunction(
-      ScalarFunction({Mol(), Mol()}, LogicalType::BOOLEAN, is_exact_match));
+  ScalarFunction is_exact_match_fun({Mol(), Mol()}, LogicalType::BOOLEAN,
+                                    is_exact_match, MolCompareBind);
+  is_exact_match_fun.init_local_state = MolCompareInitLocalState;
+  set.AddFunction(is_exact_match_fun);
   loader.RegisterFunction(set);
 
+  ScalarFunctionSet set_mol_hash("mol_hash");
+  set_mol_hash.AddFunction(GetMolHashFunction());
+  loader.RegisterFunction(set_mol_hash);
+
   ScalarFunctionSet set_is_substruct("is_substruct");
-  set_is_substruct.AddFunction(
-      ScalarFunction({Mol(), Mol()}, LogicalType::BOOLEAN, is_substruct));
+  ScalarFunction is_substruct_fun({Mol(), Mol()}, LogicalType::BOOLEAN,
+                                  is_substruct, MolCompareBind);
+  is_substruct_fun.init_local_state = MolCompareInitLocalState;
+  set_is_substruct.AddFunction(is_substruct_fun);
   loader.RegisterFunction(set_is_substruct);
+
+  OptimizerExtension optimizer;
+  optimizer.pre_optimize_function = ExactMatchJoinPreOptimize;
+  auto &config = DBConfig::GetConfig(loader.GetDatabaseInstance());
+  config.optimizer_extensions.push_back(std::move(optimizer));
 }
 
 } // namespace duckdb
@@ -7,11 +7,22 @@
 #include "duckdb/common/vector_operations/unary_executor.hpp"
 #include "duckdb/execution/expression_executor_state.hpp"
 #include "duckdb/function/function_set.hpp"
+#include "duckdb/main/config.hpp"
 #include "duckdb/main/extension/extension_loader.hpp"
+#include "duckdb/optimizer/optimizer_extension.hpp"
+#include "duckdb/planner/column_binding_map.hpp"
+#include "duckdb/planner/expression/bound_columnref_expression.hpp"
+#include "duckdb/planner/expression/bound_constant_expression.hpp"
+#include "duckdb/planner/expression/bound_function_expression.hpp"
+#include "duckdb/planner/expression_iterator.hpp"
+#include "duckdb/planner/logical_operator_visitor.hpp"
+#include "duckdb/planner/operator/logical_projection.hpp"
+#include "mol_cache.hpp"
 #include "mol_formats.hpp"
 #include "qed.hpp"
 #include "types.hpp"
 #include "umbra_mol.hpp"
+#include <GraphMol/Descriptors/MolDescriptors.h>
 
 namespace duckdb {
 
@@ -19,12 +30,12 @@ void mol_logp(DataChunk &args, ExpressionState &state, Vector &result) {
   D_ASSERT(args.data.size() == 1);
   auto &binary_umbra_mol = args.data[0];
   auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
 
   UnaryExecutor::Execute<string_t, float>(
       binary_umbra_mol, result, count, [&](string_t b_umbra_mol) {
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-        auto mol = rdkit_binary_mol_to_mol(bmol);
+        auto mol = cache.GetMol(umbra_mol);
         double logp, _;
         RDKit::Descriptors::calcCrippenDescriptors(*mol, logp, _);
         return logp;
@@ -35,14 +46,16 @@ void mol_qed(DataChunk &args, ExpressionState &state, Vector &result) {
   D_ASSERT(args.data.size() == 1);
   auto &binary_umbra_mol = args.data[0];
   auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
+  // the patterns are shared, the buffers are reused for all rows of the chunk
+  auto &qed = QED::Get();
+  QED::Buffers buffers;
 
   UnaryExecutor::Execute<string_t, float>(
       binary_umbra_mol, result, count, [&](string_t b_umbra_mol) {
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-        auto mol = rdkit_binary_mol_to_mol(bmol);
-        auto qed = QED();
-        return qed.CalcQED(*mol);
+        auto mol = cache.GetMol(umbra_mol);
+        return qed.CalcQED(*mol, buffers);
       });
 }
 
@@ -50,12 +63,12 @@ void mol_amw(DataChunk &args, ExpressionState &state, Vector &result) {
   D_ASSERT(args.data.size() == 1);
   auto &binary_umbra_mol = args.data[0];
   auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
 
   UnaryExecutor::Execute<string_t, float>(
       binary_umbra_mol, result, count, [&](string_t b_umbra_mol) {
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-        auto mol = rdkit_binary_mol_to_mol(bmol);
+        auto mol = cache.GetMol(umbra_mol);
         return RDKit::Descriptors::calcAMW(*mol);
       });
 }
@@ -64,12 +77,12 @@ void mol_exactmw(DataChunk &args, ExpressionState &state, Vector &result) {
   D_ASSERT(args.data.size() == 1);
   auto &binary_umbra_mol = args.data[0];
   auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
 
   UnaryExecutor::Execute<string_t, float>(
       binary_umbra_mol, result, count, [&](string_t b_umbra_mol) {
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-        auto mol = rdkit_binary_mol_to_mol(bmol);
+        auto mol = cache.GetMol(umbra_mol);
         return RDKit::Descriptors::calcExactMW(*mol);
       });
 }
@@ -78,12 +91,12 @@ void mol_tpsa(DataChunk &args, ExpressionState &state, Vector &result) {
   D_ASSERT(args.data.size() == 1);
   auto &binary_umbra_mol = args.data[0];
   auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
 
   UnaryExecutor::Execute<string_t, float>(
       binary_umbra_mol, result, count, [&](string_t b_umbra_mol) {
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-        auto mol = rdkit_binary_mol_to_mol(bmol);
+        auto mol = cache.GetMol(umbra_mol);
         return RDKit::Descriptors::calcTPSA(*mol);
       });
 }
@@ -92,12 +105,12 @@ void mol_hbd(DataChunk &args, ExpressionState &state, Vector &result) {
   D_ASSERT(args.data.size() == 1);
   auto &binary_umbra_mol = args.data[0];
   auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
 
   UnaryExecutor::Execute<string_t, int32_t>(
       binary_umbra_mol, result, count, [&](string_t b_umbra_mol) {
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-        auto mol = rdkit_binary_mol_to_mol(bmol);
+        auto mol = cache.GetMol(umbra_mol);
         return RDKit::Descriptors::calcNumHBD(*mol);
       });
 }
@@ -106,12 +119,12 @@ void mol_hba(DataChunk &args, ExpressionState &state, Vector &result) {
   D_ASSERT(args.data.size() == 1);
   auto &binary_umbra_mol = args.data[0];
   auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
 
   UnaryExecutor::Execute<string_t, int32_t>(
       binary_umbra_mol, result, count, [&](string_t b_umbra_mol) {
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-        auto mol = rdkit_binary_mol_to_mol(bmol);
+        auto mol = cache.GetMol(umbra_mol);
         return RDKit::Descriptors::calcNumHBA(*mol);
       });
 }
@@ -121,16 +134,340 @@ void mol_num_rotatable_bonds(DataChunk &args, ExpressionState &state,
   D_ASSERT(args.data.size() == 1);
   auto &binary_umbra_mol = args.data[0];
   auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
 
   UnaryExecutor::Execute<string_t, int32_t>(
       binary_umbra_mol, result, count, [&](string_t b_umbra_mol) {
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-        auto mol = rdkit_binary_mol_to_mol(bmol);
+        auto mol = cache.GetMol(umbra_mol);
         return RDKit::Descriptors::calcNumRotatableBonds(*mol);
       });
 }
 
+//===--------------------------------------------------------------------===//
+// mol_descriptors
+//===--------------------------------------------------------------------===//
+// The fields of the STRUCT returned by mol_descriptors, in order
+enum MolDescriptorField : idx_t {
+  DESCRIPTOR_AMW,
+  DESCRIPTOR_EXACTMW,
+  DESCRIPTOR_LOGP,
+  DESCRIPTOR_MR,
+  DESCRIPTOR_TPSA,
+  DESCRIPTOR_HBD,
+  DESCRIPTOR_HBA,
+  DESCRIPTOR_NUM_ROTATABLE_BONDS,
+  DESCRIPTOR_NUM_HEAVY_ATOMS,
+  DESCRIPTOR_NUM_RINGS,
+  DESCRIPTOR_NUM_AROMATIC_RINGS,
+  DESCRIPTOR_FRACTION_CSP3,
+  DESCRIPTOR_QED,
+  DESCRIPTOR_COUNT
+};
+
+static constexpr idx_t ALL_DESCRIPTORS = (idx_t(1) << DESCRIPTOR_COUNT) - 1;
+
+static child_list_t<LogicalType> MolDescriptorsFields() {
+  return {{"amw", LogicalType::FLOAT},
+          {"exactmw", LogicalType::FLOAT},
+          {"logp", LogicalType::FLOAT},
+          {"mr", LogicalType::FLOAT},
+          {"tpsa", LogicalType::FLOAT},
+          {"hbd", LogicalType::INTEGER},
+          {"hba", LogicalType::INTEGER},
+          {"num_rotatable_bonds", LogicalType::INTEGER},
+          {"num_heavy_atoms", LogicalType::INTEGER},
+          {"num_rings", LogicalType::INTEGER},
+          {"num_aromatic_rings", LogicalType::INTEGER},
+          {"fraction_csp3", LogicalType::FLOAT},
+          {"qed", LogicalType::FLOAT}};
+}
+
+// The fields that are calculated. It starts out as all fields, and the
+// optimizer rule below narrows it down to the fields that the query uses.
+// The fields that are not calculated are NULL.
+struct MolDescriptorsBindData : public FunctionData {
+  explicit MolDescriptorsBindData(idx_t fields) : fields(fields) {}
+
+  // bit i is set if field i is calculated
+  idx_t fields;
+
+  bool Has(MolDescriptorField field) const {
+    return fields & (idx_t(1) << field);
+  }
+
+  unique_ptr<FunctionData> Copy() const override {
+    return make_uniq<MolDescriptorsBindData>(fields);
+  }
+
+  bool Equals(const FunctionData &other_p) const override {
+    return fields == other_p.Cast<MolDescriptorsBindData>().fields;
+  }
+};
+
+static unique_ptr<FunctionData>
+MolDescriptorsBind(ClientContext &context, ScalarFunction &bound_function,
+                   vector<unique_ptr<Expression>> &arguments) {
+  return make_uniq<MolDescriptorsBindData>(ALL_DESCRIPTORS);
+}
+
+void mol_descriptors(DataChunk &args, ExpressionState &state, Vector &result) {
+  D_ASSERT(args.data.size() == 1);
+  auto &func_expr = state.expr.Cast<BoundFunctionExpression>();
+  auto &info = func_expr.bind_info->Cast<MolDescriptorsBindData>();
+  auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
+
+  UnifiedVectorFormat mol_format;
+  args.data[0].ToUnifiedFormat(count, mol_format);
+  auto mols = UnifiedVectorFormat::GetData<string_t>(mol_format);
+
+  result.SetVectorType(VectorType::FLAT_VECTOR);
+  auto &fields = StructVector::GetEntries(result);
+  for (idx_t field = 0; field < DESCRIPTOR_COUNT; field++) {
+    fields[field]->SetVectorType(VectorType::FLAT_VECTOR);
+    if (!info.Has(MolDescriptorField(field))) {
+      FlatVector::Validity(*fields[field]).SetAllInvalid(count);
+    }
+  }
+  QED::Buffers qed_buffers;
+  auto float_data = [&](MolDescriptorField field) {
+    return FlatVector::GetData<float>(*fields[field]);
+  };
+  auto int_data = [&](MolDescriptorField field) {
+    return FlatVector::GetData<int32_t>(*fields[field]);
+  };
+
+  for (idx_t i = 0; i < count; i++) {
+    auto mol_idx = mol_format.sel->get_index(i);
+    if (!mol_format.validity.RowIsValid(mol_idx)) {
+      // also sets the fields NULL, a NULL struct has NULL fields
+      FlatVector::SetNull(result, i, true);
+      continue;
+    }
+    auto b_umbra_mol = mols[mol_idx];
+    auto mol = cache.GetMol(umbra_mol_t(b_umbra_mol));
+
+    // the descriptors that QED also needs are calculated once and shared
+    auto need_qed = info.Has(DESCRIPTOR_QED);
+    double amw = 0;
+    if (info.Has(DESCRIPTOR_AMW) || need_qed) {
+      amw = RDKit::Descriptors::calcAMW(*mol);
+    }
+    double logp = 0, mr = 0;
+    if (info.Has(DESCRIPTOR_LOGP) || info.Has(DESCRIPTOR_MR) || need_qed) {
+      // LogP and MR come from the same atom contributions
+      RDKit::Descriptors::calcCrippenDescriptors(*mol, logp, mr);
+    }
+    double tpsa = 0;
+    if (info.Has(DESCRIPTOR_TPSA) || need_qed) {
+      tpsa = RDKit::Descriptors::calcTPSA(*mol);
+    }
+    unsigned int hbd = 0;
+    if (info.Has(DESCRIPTOR_HBD) || need_qed) {
+      hbd = RDKit::Descriptors::calcNumHBD(*mol);
+    }
+
+    if (info.Has(DESCRIPTOR_AMW)) {
+      float_data(DESCRIPTOR_AMW)[i] = amw;
+    }
+    if (info.Has(DESCRIPTOR_EXACTMW)) {
+      float_data(DESCRIPTOR_EXACTMW)[i] =
+          RDKit::Descriptors::calcExactMW(*mol);
+    }
+    if (info.Has(DESCRIPTOR_LOGP)) {
+      float_data(DESCRIPTOR_LOGP)[i] = logp;
+    }
+    if (info.Has(DESCRIPTOR_MR)) {
+      float_data(DESCRIPTOR_MR)[i] = mr;
+    }
+    if (info.Has(DESCRIPTOR_TPSA)) {
+      float_data(DESCRIPTOR_TPSA)[i] = tpsa;
+    }
+    if (info.Has(DESCRIPTOR_HBD)) {
+      int_data(DESCRIPTOR_HBD)[i] = hbd;
+    }
+    if (info.Has(DESCRIPTOR_HBA)) {
+      int_data(DESCRIPTOR_HBA)[i] = RDKit::Descriptors::calcNumHBA(*mol);
+    }
+    if (info.Has(DESCRIPTOR_NUM_ROTATABLE_BONDS)) {
+      int_data(DESCRIPTOR_NUM_ROTATABLE_BONDS)[i] =
+          RDKit::Descriptors::calcNumRotatableBonds(*mol);
+    }
+    if (info.Has(DESCRIPTOR_NUM_HEAVY_ATOMS)) {
+      int_data(DESCRIPTOR_NUM_HEAVY_ATOMS)[i] = mol->getNumHeavyAtoms();
+    }
+    if (info.Has(DESCRIPTOR_NUM_RINGS)) {
+      int_data(DESCRIPTOR_NUM_RINGS)[i] = RDKit::Descriptors::calcNumRings(*mol);
+    }
+    if (info.Has(DESCRIPTOR_NUM_AROMATIC_RINGS)) {
+      int_data(DESCRIPTOR_NUM_AROMATIC_RINGS)[i] =
+          RDKit::Descriptors::calcNumAromaticRings(*mol);
+    }
+    if (info.Has(DESCRIPTOR_FRACTION_CSP3)) {
+      float_data(DESCRIPTOR_FRACTION_CSP3)[i] =
+          RDKit::Descriptors::calcFractionCSP3(*mol);
+    }
+    if (need_qed) {
+      float_data(DESCRIPTOR_QED)[i] =
+          QED::Get().CalcQED(*mol, amw, logp, hbd, tpsa, qed_buffers);
+    }
+  }
+
+  if (args.AllConstant()) {
+    result.SetVectorType(VectorType::CONSTANT_VECTOR);
+  }
+}
+
+//===--------------------------------------------------------------------===//
+// mol_descriptors field pruning
+//===--------------------------------------------------------------------===//
+// Finds the fields of mol_descriptors that a query uses, and sets the bind
+// data of each call so that only those fields are calculated. A field is
+// used if it is extracted from the struct directly:
+//
+//   SELECT mol_descriptors(m).logp, mol_descriptors(m).tpsa FROM t
+//
+// or from the column of a projection that is a mol_descriptors call:
+//
+//   SELECT d.logp FROM (SELECT mol_descriptors(m) AS d FROM t)
+//
+// Any other use of the struct uses all the fields.
+struct MolDescriptorsCall {
+  BoundFunctionExpression &call;
+  idx_t fields = 0;
+  // for calls that are the output of a projection: whether the output is
+  // referenced by an expression in the plan
+  bool referenced = false;
+};
+
+struct MolDescriptorsUsage {
+  vector<MolDescriptorsCall> calls;
+  // projection outputs that are a mol_descriptors call, to the call
+  column_binding_map_t<idx_t> projected_calls;
+};
+
+static bool IsMolDescriptorsCall(Expression &expr) {
+  return expr.expression_class == ExpressionClass::BOUND_FUNCTION &&
+         expr.Cast<BoundFunctionExpression>().function.name ==
+             "mol_descriptors";
+}
+
+// Returns the field that expr extracts from its first child, or all the
+// fields if expr is not a struct extract
+static idx_t GetExtractedFields(optional_ptr<Expression> expr) {
+  if (!expr || expr->expression_class != ExpressionClass::BOUND_FUNCTION) {
+    return ALL_DESCRIPTORS;
+  }
+  auto &func = expr->Cast<BoundFunctionExpression>();
+  auto &name = func.function.name;
+  if ((name != "struct_extract" && name != "array_extract" &&
+       name != "struct_extract_at") ||
+      func.children.size() != 2 ||
+      func.children[1]->type != ExpressionType::VALUE_CONSTANT) {
+    return ALL_DESCRIPTORS;
+  }
+  auto &key = func.children[1]->Cast<BoundConstantExpression>().value;
+  if (key.IsNull()) {
+    return ALL_DESCRIPTORS;
+  }
+  auto fields = MolDescriptorsFields();
+  if (key.type().id() == LogicalTypeId::VARCHAR) {
+    auto &field_name = StringValue::Get(key);
+    for (idx_t field = 0; field < fields.size(); field++) {
+      if (StringUtil::CIEquals(fields[field].first, field_name)) {
+        return idx_t(1) << field;
+      }
+    }
+    return ALL_DESCRIPTORS;
+  }
+  if (key.type().IsIntegral()) {
+    // the index of the field, starting at 1
+    auto index = key.GetValue<int64_t>();
+    if (index >= 1 && index <= int64_t(fields.size())) {
+      return idx_t(1) << (index - 1);
+    }
+  }
+  return ALL_DESCRIPTORS;
+}
+
+template <class FUNC>
+static void VisitExpression(Expression &expr, optional_ptr<Expression> parent,
+                            FUNC &callback) {
+  callback(expr, parent);
+  ExpressionIterator::EnumerateChildren(expr, [&](Expression &child) {
+    VisitExpression(child, &expr, callback);
+  });
+}
+
+template <class FUNC>
+static void VisitPlanExpressions(LogicalOperator &op, FUNC &callback) {
+  LogicalOperatorVisitor::EnumerateExpressions(
+      op, [&](unique_ptr<Expression> *expr) {
+        VisitExpression(**expr, nullptr, callback);
+      });
+  for (auto &child : op.children) {
+    VisitPlanExpressions(*child, callback);
+  }
+}
+
+static void CollectMolDescriptorsCalls(LogicalOperator &op,
+                                       MolDescriptorsUsage &usage) {
+  if (op.type == LogicalOperatorType::LOGICAL_PROJECTION) {
+    auto &projection = op.Cast<LogicalProjection>();
+    for (idx_t i = 0; i < projection.expressions.size(); i++) {
+      auto &expr = *projection.expressions[i];
+      if (IsMolDescriptorsCall(expr)) {
+        usage.projected_calls[ColumnBinding(projection.table_index, i)] =
+            usage.calls.size();
+        usage.calls.push_back({expr.Cast<BoundFunctionExpression>()});
+      }
+    }
+  }
+  for (auto &child : op.children) {
+    CollectMolDescriptorsCalls(*child, usage);
+  }
+}
+
+static void PruneMolDescriptors(LogicalOperator &plan) {
+  MolDescriptorsUsage usage;
+  CollectMolDescriptorsCalls(plan, usage);
+
+  auto visit = [&](Expression &expr, optional_ptr<Expression> parent) {
+    if (expr.type == ExpressionType::BOUND_COLUMN_REF) {
+      auto &colref = expr.Cast<BoundColumnRefExpression>();
+      auto entry = usage.projected_calls.find(colref.binding);
+      if (entry != usage.projected_calls.end()) {
+        auto &call = usage.calls[entry->second];
+        call.referenced = true;
+        call.fields |= GetExtractedFields(parent);
+      }
+      return;
+    }
+    if (!IsMolDescriptorsCall(expr) || !parent) {
+      // the calls that are the output of a projection are handled through
+      // the column references to them
+      return;
+    }
+    usage.calls.push_back({expr.Cast<BoundFunctionExpression>()});
+    usage.calls.back().referenced = true;
+    usage.calls.back().fields = GetExtractedFields(parent);
+  };
+  VisitPlanExpressions(plan, visit);
+
+  for (auto &entry : usage.calls) {
+    // a projection output that no expression refers to is either a result
+    // column of the query, or read by position (e.g. INSERT or UNION)
+    auto fields = entry.referenced ? entry.fields : ALL_DESCRIPTORS;
+    entry.call.bind_info = make_uniq<MolDescriptorsBindData>(fields);
+  }
+}
+
+static void MolDescriptorsPreOptimize(OptimizerExtensionInput &input,
+                                      unique_ptr<LogicalOperator> &plan) {
+  PruneMolDescriptors(*plan);
+}
+
 void RegisterDescriptorFunctions(ExtensionLoader &loader) {
   ScalarFunctionSet set_mol_amw("mol_amw");
   set_mol_amw.AddFunction(ScalarFunction({Mol()}, LogicalType::FLOAT, mol_amw));
@@ -169,5 +506,16 @@ void RegisterDescriptorFunctions(ExtensionLoader &loader) {
   set_mol_num_rotatable_bonds.AddFunction(
       ScalarFunction({Mol()}, LogicalType::INTEGER, mol_num_rotatable_bonds));
   loader.RegisterFunction(set_mol_num_rotatable_bonds);
+
+  ScalarFunctionSet set_mol_descriptors("mol_descriptors");
+  set_mol_descriptors.AddFunction(
+      ScalarFunction({Mol()}, LogicalType::STRUCT(MolDescriptorsFields()),
+                     mol_descriptors, MolDescriptorsBind));
+  loader.RegisterFunction(set_mol_descriptors);
+
+  OptimizerExtension optimizer;
+  optimizer.pre_optimize_function = MolDescriptorsPreOptimize;
+  auto &config = DBConfig::GetConfig(loader.GetDatabaseInstance());
+  config.optimizer_extensions.push_back(std::move(optimizer));
 }
 } // namespace duckdb
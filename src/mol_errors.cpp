@@ -0,0 +1,146 @@
+#include "mol_errors.hpp"
+#include "duckdb/execution/expression_executor_state.hpp"
+#include "duckdb/function/table_function.hpp"
+#include <RDGeneral/RDLog.h>
+
+namespace duckdb {
+
+shared_ptr<MolErrorState> MolErrorState::Get(ClientContext &context) {
+  return context.registered_state->GetOrCreate<MolErrorState>(
+      "duckdb_rdkit_mol_errors");
+}
+
+void MolErrorState::QueryBegin(ClientContext &) {
+  lock_guard<mutex> guard(lock);
+  if (!made_molecules) {
+    return;
+  }
+  last_errors = std::move(errors);
+  errors.clear();
+  made_molecules = false;
+}
+
+void MolErrorState::AddErrors(vector<MolError> &new_errors) {
+  lock_guard<mutex> guard(lock);
+  made_molecules = true;
+  for (auto &error : new_errors) {
+    if (errors.size() >= MAX_ERRORS) {
+      break;
+    }
+    errors.push_back(std::move(error));
+  }
+  new_errors.clear();
+}
+
+vector<MolError> MolErrorState::GetLastErrors() {
+  lock_guard<mutex> guard(lock);
+  return last_errors;
+}
+
+static mutex log_blocker_lock;
+static idx_t log_blocker_count = 0;
+static std::unique_ptr<RDLog::BlockLogs> log_block;
+
+RDKitLogBlocker::RDKitLogBlocker() {
+  lock_guard<mutex> guard(log_blocker_lock);
+  if (log_blocker_count++ == 0) {
+    log_block = std::make_unique<RDLog::BlockLogs>();
+  }
+}
+
+RDKitLogBlocker::~RDKitLogBlocker() {
+  lock_guard<mutex> guard(log_blocker_lock);
+  if (--log_blocker_count == 0) {
+    // turns the logs that were on back on
+    log_block.reset();
+  }
+}
+
+SmilesMolParser::SmilesMolParser(optional_ptr<ClientContext> context) {
+  // casts folded without a connection do not report their errors
+  if (context) {
+    error_state = MolErrorState::Get(*context);
+  }
+}
+
+std::unique_ptr<RDKit::ROMol> SmilesMolParser::Parse(string_t smiles) {
+  buffer.assign(smiles.GetData(), smiles.GetSize());
+  try {
+    auto mol = RDKit::v2::SmilesParse::MolFromSmiles(buffer, params);
+    if (mol) {
+      return mol;
+    }
+    // RDKit returns no molecule for syntax errors, and throws for molecules
+    // that fail sanitization
+    last_error = "SMILES Parse Error";
+  } catch (std::exception &e) {
+    last_error = e.what();
+  }
+  errors.push_back({buffer, last_error});
+  return nullptr;
+}
+
+void SmilesMolParser::Flush() {
+  if (error_state) {
+    error_state->AddErrors(errors);
+  }
+  errors.clear();
+}
+
+unique_ptr<FunctionLocalState>
+SmilesMolParser::InitCastLocalState(CastLocalStateParameters &parameters) {
+  return make_uniq<SmilesMolParser>(parameters.context);
+}
+
+unique_ptr<FunctionLocalState>
+SmilesMolParser::InitFunctionLocalState(ExpressionState &state,
+                                        const BoundFunctionExpression &,
+                                        FunctionData *) {
+  return make_uniq<SmilesMolParser>(&state.GetContext());
+}
+
+//===--------------------------------------------------------------------===//
+// rdkit_last_errors()
+//===--------------------------------------------------------------------===//
+struct MolErrorsData : public GlobalTableFunctionState {
+  vector<MolError> errors;
+  idx_t offset = 0;
+};
+
+static unique_ptr<FunctionData>
+MolErrorsBind(ClientContext &context, TableFunctionBindInput &input,
+              vector<LogicalType> &return_types, vector<string> &names) {
+  names.emplace_back("input");
+  return_types.emplace_back(LogicalType::VARCHAR);
+  names.emplace_back("error");
+  return_types.emplace_back(LogicalType::VARCHAR);
+  return nullptr;
+}
+
+static unique_ptr<GlobalTableFunctionState>
+MolErrorsInit(ClientContext &context, TableFunctionInitInput &input) {
+  auto result = make_uniq<MolErrorsData>();
+  result->errors = MolErrorState::Get(context)->GetLastErrors();
+  return std::move(result);
+}
+
+static void MolErrorsFunction(ClientContext &context,
+                              TableFunctionInput &data_p, DataChunk &output) {
+  auto &data = data_p.global_state->Cast<MolErrorsData>();
+  idx_t count = 0;
+  while (data.offset < data.errors.size() && count < STANDARD_VECTOR_SIZE) {
+    auto &error = data.errors[data.offset++];
+    output.SetValue(0, count, Value(error.input));
+    output.SetValue(1, count, Value(error.message));
+    count++;
+  }
+  output.SetCardinality(count);
+}
+
+void RegisterMolErrorFunctions(ExtensionLoader &loader) {
+  TableFunction rdkit_last_errors("rdkit_last_errors", {}, MolErrorsFunction,
+                                  MolErrorsBind, MolErrorsInit);
+  loader.RegisterFunction(rdkit_last_errors);
+}
+
+} // namespace duckdb
@@ -0,0 +1,166 @@
+#include "mol_fingerprint.hpp"
+#include "bit_fp.hpp"
+#include "common.hpp"
+#include "duckdb/common/exception.hpp"
+#include "duckdb/common/types/vector.hpp"
+#include "duckdb/common/vector_operations/ternary_executor.hpp"
+#include "duckdb/execution/expression_executor_state.hpp"
+#include "duckdb/function/function_set.hpp"
+#include "fp_kernels.hpp"
+#include "mol_cache.hpp"
+#include "mol_formats.hpp"
+#include "types.hpp"
+#include "umbra_mol.hpp"
+#include <DataStructs/ExplicitBitVect.h>
+#include <GraphMol/Fingerprints/MorganFingerprints.h>
+
+namespace duckdb {
+
+static constexpr int32_t DEFAULT_MORGAN_RADIUS = 2;
+static constexpr int32_t DEFAULT_MORGAN_NBITS = 2048;
+
+static void check_same_length(bit_fp_t &a, bit_fp_t &b) {
+  // BitFP is a BLOB, so any blob can be cast to it. One without the popcount
+  // prefix has no bits, and GetNumBytes would underflow
+  if (a.GetSize() < bit_fp_t::POPCOUNT_BYTES ||
+      b.GetSize() < bit_fp_t::POPCOUNT_BYTES) {
+    throw InvalidInputException(
+        "Fingerprint is too short to be a BitFP (%llu bytes, at least %llu "
+        "needed)",
+        MinValue(a.GetSize(), b.GetSize()), bit_fp_t::POPCOUNT_BYTES);
+  }
+  if (a.GetSize() != b.GetSize()) {
+    throw InvalidInputException(
+        "Cannot compare fingerprints of different lengths (%llu and %llu "
+        "bits)",
+        a.GetNumBits(), b.GetNumBits());
+  }
+}
+
+double tanimoto_similarity(bit_fp_t a, bit_fp_t b) {
+  check_same_length(a, b);
+  // the popcounts of a and b are stored in the prefix. Only the popcount of
+  // the intersection needs to be computed
+  double a_count = a.GetPopcount();
+  double b_count = b.GetPopcount();
+  double both_count = fp_popcount_and(a.GetBits(), b.GetBits(), a.GetNumBytes());
+  double denominator = a_count + b_count - both_count;
+  if (denominator == 0) {
+    return 1.0;
+  }
+  return both_count / denominator;
+}
+
+double dice_similarity(bit_fp_t a, bit_fp_t b) {
+  check_same_length(a, b);
+  double a_count = a.GetPopcount();
+  double b_count = b.GetPopcount();
+  double both_count = fp_popcount_and(a.GetBits(), b.GetBits(), a.GetNumBytes());
+  double denominator = a_count + b_count;
+  if (denominator == 0) {
+    return 1.0;
+  }
+  return 2 * both_count / denominator;
+}
+
+// Writes the Morgan fingerprint of the molecule as a BitFP directly into the
+// result vector
+static string_t make_morgan_fp(Vector &result, const RDKit::ROMol &mol,
+                               int32_t radius, int32_t nbits) {
+  if (radius < 0) {
+    throw InvalidInputException("Morgan fingerprint radius must be >= 0");
+  }
+  if (nbits <= 0 || nbits % bit_fp_t::WORD_BITS != 0) {
+    throw InvalidInputException(
+        "Morgan fingerprint size must be a positive multiple of %llu bits",
+        bit_fp_t::WORD_BITS);
+  }
+
+  std::unique_ptr<ExplicitBitVect> fp(
+      RDKit::MorganFingerprints::getFingerprintAsBitVect(mol, radius, nbits));
+  std::vector<int> on_bits;
+  fp->getOnBits(on_bits);
+
+  auto target = StringVector::EmptyString(
+      result, bit_fp_t::POPCOUNT_BYTES + idx_t(nbits) / 8);
+  auto data = target.GetDataWriteable();
+  memset(data, 0, target.GetSize());
+  bit_fp_t::EncodePopcount(on_bits.size(), data);
+  auto bits = data + bit_fp_t::POPCOUNT_BYTES;
+  for (auto bit : on_bits) {
+    bits[bit / 8] |= char(1 << (bit % 8));
+  }
+  target.Finalize();
+  return target;
+}
+
+void mol_morgan_fp(DataChunk &args, ExpressionState &state, Vector &result) {
+  D_ASSERT(args.data.size() == 3);
+  auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
+
+  TernaryExecutor::Execute<string_t, int32_t, int32_t, string_t>(
+      args.data[0], args.data[1], args.data[2], result, count,
+      [&](string_t b_umbra_mol, int32_t radius, int32_t nbits) {
+        auto umbra_mol = umbra_mol_t(b_umbra_mol);
+        auto mol = cache.GetMol(umbra_mol);
+        return make_morgan_fp(result, *mol, radius, nbits);
+      });
+}
+
+void mol_morgan_fp_default(DataChunk &args, ExpressionState &state,
+                           Vector &result) {
+  D_ASSERT(args.data.size() == 1);
+  auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
+
+  UnaryExecutor::Execute<string_t, string_t>(
+      args.data[0], result, count, [&](string_t b_umbra_mol) {
+        auto umbra_mol = umbra_mol_t(b_umbra_mol);
+        auto mol = cache.GetMol(umbra_mol);
+        return make_morgan_fp(result, *mol, DEFAULT_MORGAN_RADIUS,
+                              DEFAULT_MORGAN_NBITS);
+      });
+}
+
+void tanimoto(DataChunk &args, ExpressionState &state, Vector &result) {
+  D_ASSERT(args.data.size() == 2);
+
+  BinaryExecutor::Execute<string_t, string_t, double>(
+      args.data[0], args.data[1], result, args.size(),
+      [&](string_t &left, string_t &right) {
+        return tanimoto_similarity(bit_fp_t(left), bit_fp_t(right));
+      });
+}
+
+void dice(DataChunk &args, ExpressionState &state, Vector &result) {
+  D_ASSERT(args.data.size() == 2);
+
+  BinaryExecutor::Execute<string_t, string_t, double>(
+      args.data[0], args.data[1], result, args.size(),
+      [&](string_t &left, string_t &right) {
+        return dice_similarity(bit_fp_t(left), bit_fp_t(right));
+      });
+}
+
+void RegisterFingerprintFunctions(ExtensionLoader &loader) {
+  ScalarFunctionSet set_mol_morgan_fp("mol_morgan_fp");
+  set_mol_morgan_fp.AddFunction(
+      ScalarFunction({Mol()}, BitFP(), mol_morgan_fp_default));
+  set_mol_morgan_fp.AddFunction(ScalarFunction(
+      {Mol(), LogicalType::INTEGER, LogicalType::INTEGER}, BitFP(),
+      mol_morgan_fp));
+  loader.RegisterFunction(set_mol_morgan_fp);
+
+  ScalarFunctionSet set_tanimoto("tanimoto");
+  set_tanimoto.AddFunction(
+      ScalarFunction({BitFP(), BitFP()}, LogicalType::DOUBLE, tanimoto));
+  loader.RegisterFunction(set_tanimoto);
+
+  ScalarFunctionSet set_dice("dice");
+  set_dice.AddFunction(
+      ScalarFunction({BitFP(), BitFP()}, LogicalType::DOUBLE, dice));
+  loader.RegisterFunction(set_dice);
+}
+
+} // namespace duckdb
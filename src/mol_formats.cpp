@@ -2,6 +2,8 @@
 #include "duckdb/common/types.hpp"
 #include "duckdb/execution/expression_executor_state.hpp"
 #include "duckdb/function/function_set.hpp"
+#include "mol_cache.hpp"
+#include "mol_errors.hpp"
 #include "types.hpp"
 #include "umbra_mol.hpp"
 #include <GraphMol/Descriptors/MolDescriptors.h>
@@ -11,12 +13,16 @@
 #include <GraphMol/SmilesParse/SmartsWrite.h>
 #include <GraphMol/SmilesParse/SmilesParse.h>
 #include <GraphMol/SmilesParse/SmilesWrite.h>
+#include <istream>
+#include <streambuf>
 
 namespace duckdb {
 // Expects a SMILES string and returns a RDKit pickled molecule
 std::unique_ptr<RDKit::ROMol> rdkit_mol_from_smiles(std::string s) {
   std::string smiles = s;
   std::unique_ptr<RDKit::ROMol> mol;
+  // the error is thrown, RDKit does not need to log it
+  RDKitLogBlocker log_blocker;
   try {
     mol.reset(RDKit::SmilesToMol(smiles));
   } catch (std::exception &e) {
@@ -33,7 +39,7 @@ std::unique_ptr<RDKit::ROMol> rdkit_mol_from_smiles(std::string s) {
 }
 
 // Serialize a molecule to binary using RDKit's MolPickler
-std::string rdkit_mol_to_binary_mol(const RDKit::ROMol mol) {
+std::string rdkit_mol_to_binary_mol(const RDKit::ROMol &mol) {
   std::string buf;
   try {
     RDKit::MolPickler::pickleMol(mol, buf);
@@ -45,14 +51,26 @@ std::string rdkit_mol_to_binary_mol(const RDKit::ROMol mol) {
 }
 
 // Deserialize a binary mol to RDKit mol
-std::unique_ptr<RDKit::ROMol> rdkit_binary_mol_to_mol(std::string bmol) {
+std::unique_ptr<RDKit::ROMol> rdkit_binary_mol_to_mol(const char *bmol,
+                                                      idx_t size) {
+  ReadOnlyMemoryBuf buf(bmol, size);
+  std::istream stream(&buf);
   std::unique_ptr<RDKit::ROMol> mol(new RDKit::ROMol());
-  RDKit::MolPickler::molFromPickle(bmol, *mol);
+  RDKit::MolPickler::molFromPickle(stream, *mol);
 
   return mol;
 }
 
-std::string rdkit_mol_to_smiles(RDKit::ROMol mol) {
+std::unique_ptr<RDKit::ROMol> rdkit_binary_mol_to_mol(const std::string &bmol) {
+  return rdkit_binary_mol_to_mol(bmol.data(), bmol.size());
+}
+
+std::unique_ptr<RDKit::ROMol> rdkit_umbra_mol_to_mol(umbra_mol_t umbra_mol) {
+  return rdkit_binary_mol_to_mol(umbra_mol.GetBinaryMolData(),
+                                 umbra_mol.GetBinaryMolSize());
+}
+
+std::string rdkit_mol_to_smiles(const RDKit::ROMol &mol) {
   std::string smiles = RDKit::MolToSmiles(mol);
   return smiles;
 }
@@ -61,40 +79,74 @@ void mol_to_smiles(DataChunk &args, ExpressionState &state, Vector &result) {
   D_ASSERT(args.data.size() == 1);
   auto &bmol = args.data[0];
   auto count = args.size();
+  auto &cache = DecodedMolCache::Get(state);
 
   UnaryExecutor::Execute<string_t, string_t>(
       bmol, result, count, [&](string_t b_umbra_mol) {
         auto umbra_mol = umbra_mol_t(b_umbra_mol);
-        auto bmol = umbra_mol.GetBinaryMol();
-        auto mol = rdkit_binary_mol_to_mol(bmol);
+        if (umbra_mol.HasSmiles()) {
+          return StringVector::AddString(result, umbra_mol.GetSmiles());
+        }
+        auto mol = cache.GetMol(umbra_mol);
         auto smiles = rdkit_mol_to_smiles(*mol);
         return StringVector::AddString(result, smiles);
       });
 }
 
+// SMILES that are not valid give NULL, and their errors are reported by
+// rdkit_last_errors()
 void mol_from_smiles(DataChunk &args, ExpressionState &state, Vector &result) {
   D_ASSERT(args.data.size() == 1);
   auto &smiles = args.data[0];
   auto count = args.size();
+  auto &parser =
+      ExecuteFunctionState::GetFunctionState(state)->Cast<SmilesMolParser>();
 
   UnaryExecutor::ExecuteWithNulls<string_t, string_t>(
       smiles, result, count,
       [&](string_t smiles, ValidityMask &mask, idx_t idx) {
-        try {
-          auto mol = rdkit_mol_from_smiles(smiles.GetString());
+        auto mol = parser.Parse(smiles);
+        if (!mol) {
+          mask.SetInvalid(idx);
+          return string_t();
+        }
+        auto res = get_umbra_mol_string(*mol);
 
-          auto res = get_umbra_mol_string(*mol);
+        // IMPORTANT! StringVector::AddString needs to take a std::string
+        // Using string_t::GetString() seems to mangle the data
+        return StringVector::AddStringOrBlob(result, res);
+      });
+  parser.Flush();
+}
 
-          // IMPORTANT! StringVector::AddString needs to take a std::string
-          // Using string_t::GetString() seems to mangle the data
-          return StringVector::AddStringOrBlob(result, res);
-        } catch (...) {
-          std::cout << "WARNING: could not create molecule from SMILES\n"
-                    << smiles.GetData() << std::endl;
+// mol_from_smiles(smiles, strict): with strict, a SMILES that is not valid is
+// an error instead of NULL
+void mol_from_smiles_strict(DataChunk &args, ExpressionState &state,
+                            Vector &result) {
+  D_ASSERT(args.data.size() == 2);
+  auto count = args.size();
+  auto &parser =
+      ExecuteFunctionState::GetFunctionState(state)->Cast<SmilesMolParser>();
+
+  BinaryExecutor::ExecuteWithNulls<string_t, bool, string_t>(
+      args.data[0], args.data[1], result, count,
+      [&](string_t smiles, bool strict, ValidityMask &mask, idx_t idx) {
+        auto mol = parser.Parse(smiles);
+        if (!mol) {
+          if (strict) {
+            // the errors of the rows before this one are still reported
+            parser.Flush();
+            throw InvalidInputException(
+                "Could not create molecule from SMILES \"%s\": %s",
+                smiles.GetString(), parser.LastError());
+          }
           mask.SetInvalid(idx);
           return string_t();
         }
+        auto res = get_umbra_mol_string(*mol);
+        return StringVector::AddStringOrBlob(result, res);
       });
+  parser.Flush();
 }
 
 void mol_to_rdkit_mol(DataChunk &args, ExpressionState &state, Vector &result) {
@@ -105,15 +157,25 @@ void mol_to_rdkit_mol(DataChunk &args, ExpressionState &state, Vector &result) {
   UnaryExecutor::ExecuteWithNulls<string_t, string_t>(
       umbra_mol, result, count,
       [&](umbra_mol_t umbra_mol, ValidityMask &mask, idx_t idx) {
-        return StringVector::AddStringOrBlob(result, umbra_mol.GetBinaryMol());
+        return StringVector::AddStringOrBlob(
+            result, string_t(umbra_mol.GetBinaryMolData(),
+                             umbra_mol.GetBinaryMolSize()));
       });
 }
 
 void RegisterFormatFunctions(ExtensionLoader &loader) {
   // Register scalar functions
   ScalarFunctionSet mol_from_smiles_set("mol_from_smiles");
-  mol_from_smiles_set.AddFunction(
-      ScalarFunction({LogicalType::VARCHAR}, Mol(), mol_from_smiles));
+  ScalarFunction mol_from_smiles_fun({LogicalType::VARCHAR}, Mol(),
+                                     mol_from_smiles);
+  mol_from_smiles_fun.init_local_state = SmilesMolParser::InitFunctionLocalState;
+  mol_from_smiles_set.AddFunction(mol_from_smiles_fun);
+  ScalarFunction mol_from_smiles_strict_fun(
+      {LogicalType::VARCHAR, LogicalType::BOOLEAN}, Mol(),
+      mol_from_smiles_strict);
+  mol_from_smiles_strict_fun.init_local_state =
+      SmilesMolParser::InitFunctionLocalState;
+  mol_from_smiles_set.AddFunction(mol_from_smiles_strict_fun);
   loader.RegisterFunction(mol_from_smiles_set);
 
   ScalarFunctionSet mol_to_smiles_set("mol_to_smiles");
@@ -0,0 +1,633 @@
+#include "mol_sss_index/mol_sss_index.hpp"
+#include "common.hpp"
+#include "duckdb/common/bit_utils.hpp"
+#include "duckdb/common/exception.hpp"
+#include "duckdb/common/types/vector.hpp"
+#include "duckdb/execution/index/index_type.hpp"
+#include "duckdb/execution/operator/projection/physical_projection.hpp"
+#include "duckdb/execution/physical_plan_generator.hpp"
+#include "duckdb/main/config.hpp"
+#include "duckdb/main/database.hpp"
+#include "duckdb/planner/expression/bound_reference_expression.hpp"
+#include "duckdb/planner/operator/logical_create_index.hpp"
+#include "duckdb/storage/partial_block_manager.hpp"
+#include "duckdb/storage/storage_info.hpp"
+#include "duckdb/storage/table_io_manager.hpp"
+#include "fp_kernels.hpp"
+#include "mol_formats.hpp"
+#include "mol_sss_index/mol_sss_index_scan.hpp"
+#include "mol_sss_index/physical_create_mol_sss_index.hpp"
+#include "types.hpp"
+#include <DataStructs/ExplicitBitVect.h>
+#include <GraphMol/Fingerprints/Fingerprints.h>
+#include <algorithm>
+
+namespace duckdb {
+
+static constexpr idx_t WORD_BITS = 64;
+// the row ids of a row group are contiguous, so the words of the bitmaps
+// for a row group are as well
+static constexpr idx_t ROW_GROUP_WORDS = DEFAULT_ROW_GROUP_SIZE / WORD_BITS;
+static_assert(DEFAULT_ROW_GROUP_SIZE % WORD_BITS == 0,
+              "Row groups must be a whole number of bitmap words");
+
+//===--------------------------------------------------------------------===//
+// MolSSSBitmaps
+//===--------------------------------------------------------------------===//
+MolSSSBitmaps::MolSSSBitmaps(idx_t screen_bits)
+    : bitmaps(screen_bits), bit_counts(screen_bits, 0) {}
+
+void MolSSSBitmaps::Reserve(idx_t new_num_words) {
+  if (new_num_words <= num_words) {
+    return;
+  }
+  rows.resize(new_num_words, 0);
+  for (auto &bitmap : bitmaps) {
+    bitmap.resize(new_num_words, 0);
+  }
+  num_words = new_num_words;
+  auto num_row_groups = (num_words + ROW_GROUP_WORDS - 1) / ROW_GROUP_WORDS;
+  row_group_bit_counts.resize(num_row_groups * bitmaps.size(), 0);
+}
+
+void MolSSSBitmaps::Add(row_t row_id, const std::vector<idx_t> &screen) {
+  D_ASSERT(row_id >= 0);
+  auto word = idx_t(row_id) / WORD_BITS;
+  auto mask = uint64_t(1) << (idx_t(row_id) % WORD_BITS);
+  Reserve(word + 1);
+  if (rows[word] & mask) {
+    return;
+  }
+  rows[word] |= mask;
+  row_count++;
+  auto row_group_counts =
+      &row_group_bit_counts[word / ROW_GROUP_WORDS * bitmaps.size()];
+  for (auto bit : screen) {
+    bitmaps[bit][word] |= mask;
+    bit_counts[bit]++;
+    row_group_counts[bit]++;
+  }
+}
+
+void MolSSSBitmaps::Remove(row_t row_id) {
+  auto word = idx_t(row_id) / WORD_BITS;
+  auto mask = uint64_t(1) << (idx_t(row_id) % WORD_BITS);
+  if (word >= num_words || !(rows[word] & mask)) {
+    return;
+  }
+  rows[word] &= ~mask;
+  row_count--;
+  auto row_group_counts =
+      &row_group_bit_counts[word / ROW_GROUP_WORDS * bitmaps.size()];
+  for (idx_t bit = 0; bit < bitmaps.size(); bit++) {
+    if (bitmaps[bit][word] & mask) {
+      bitmaps[bit][word] &= ~mask;
+      bit_counts[bit]--;
+      row_group_counts[bit]--;
+    }
+  }
+}
+
+void MolSSSBitmaps::Merge(const MolSSSBitmaps &other) {
+  D_ASSERT(other.bitmaps.size() == bitmaps.size());
+  Reserve(other.num_words);
+  // the rows of the two bitmaps do not overlap, the counts can be added
+  for (idx_t w = 0; w < other.num_words; w++) {
+    rows[w] |= other.rows[w];
+  }
+  for (idx_t bit = 0; bit < bitmaps.size(); bit++) {
+    for (idx_t w = 0; w < other.num_words; w++) {
+      bitmaps[bit][w] |= other.bitmaps[bit][w];
+    }
+    bit_counts[bit] += other.bit_counts[bit];
+  }
+  for (idx_t i = 0; i < other.row_group_bit_counts.size(); i++) {
+    row_group_bit_counts[i] += other.row_group_bit_counts[i];
+  }
+  row_count += other.row_count;
+}
+
+void MolSSSBitmaps::ComputeRowGroupSummaries() {
+  std::fill(row_group_bit_counts.begin(), row_group_bit_counts.end(), 0);
+  for (idx_t bit = 0; bit < bitmaps.size(); bit++) {
+    for (idx_t start = 0; start < num_words; start += ROW_GROUP_WORDS) {
+      auto end = MinValue(start + ROW_GROUP_WORDS, num_words);
+      auto bytes =
+          reinterpret_cast<const uint8_t *>(bitmaps[bit].data() + start);
+      row_group_bit_counts[start / ROW_GROUP_WORDS * bitmaps.size() + bit] =
+          fp_popcount(bytes, (end - start) * sizeof(uint64_t));
+    }
+  }
+}
+
+bool MolSSSBitmaps::RowGroupMayMatch(idx_t row_group,
+                                     const std::vector<idx_t> &query) const {
+  auto row_group_counts = &row_group_bit_counts[row_group * bitmaps.size()];
+  for (auto bit : query) {
+    if (row_group_counts[bit] == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+idx_t MolSSSBitmaps::CountCandidateRowGroups(
+    const std::vector<idx_t> &query) const {
+  idx_t count = 0;
+  auto num_row_groups = (num_words + ROW_GROUP_WORDS - 1) / ROW_GROUP_WORDS;
+  for (idx_t row_group = 0; row_group < num_row_groups; row_group++) {
+    count += RowGroupMayMatch(row_group, query);
+  }
+  return count;
+}
+
+std::vector<row_t>
+MolSSSBitmaps::Search(const std::vector<idx_t> &query) const {
+  std::vector<row_t> result;
+  std::vector<const uint64_t *> query_bitmaps;
+  query_bitmaps.reserve(query.size());
+  // AND the rarest bits first, most words are then zero after the first
+  // one or two bitmaps
+  auto sorted_query = query;
+  std::sort(sorted_query.begin(), sorted_query.end(),
+            [&](idx_t a, idx_t b) { return bit_counts[a] < bit_counts[b]; });
+  for (auto bit : sorted_query) {
+    if (bit_counts[bit] == 0) {
+      // no molecule has this bit, nothing can match
+      return result;
+    }
+    query_bitmaps.push_back(bitmaps[bit].data());
+  }
+
+  for (idx_t row_group_start = 0; row_group_start < num_words;
+       row_group_start += ROW_GROUP_WORDS) {
+    if (!RowGroupMayMatch(row_group_start / ROW_GROUP_WORDS, sorted_query)) {
+      continue;
+    }
+    auto row_group_end = MinValue(row_group_start + ROW_GROUP_WORDS, num_words);
+    for (idx_t w = row_group_start; w < row_group_end; w++) {
+      auto word = rows[w];
+      for (idx_t i = 0; i < query_bitmaps.size() && word; i++) {
+        word &= query_bitmaps[i][w];
+      }
+      while (word) {
+        auto bit = CountZeros<uint64_t>::Trailing(word);
+        result.push_back(row_t(w * WORD_BITS + bit));
+        word &= word - 1;
+      }
+    }
+  }
+  return result;
+}
+
+idx_t MolSSSBitmaps::GetInMemorySize() const {
+  return (bitmaps.size() + 1) * num_words * sizeof(uint64_t) +
+         bit_counts.size() * sizeof(idx_t) +
+         row_group_bit_counts.size() * sizeof(uint32_t);
+}
+
+template <class WRITER> void MolSSSBitmaps::Serialize(WRITER &writer) const {
+  uint64_t header[3] = {bitmaps.size(), num_words, row_count};
+  writer.WriteData(const_data_ptr_cast(header), sizeof(header));
+  writer.WriteData(const_data_ptr_cast(bit_counts.data()),
+                   bit_counts.size() * sizeof(idx_t));
+  writer.WriteData(const_data_ptr_cast(rows.data()),
+                   num_words * sizeof(uint64_t));
+  for (auto &bitmap : bitmaps) {
+    writer.WriteData(const_data_ptr_cast(bitmap.data()),
+                     num_words * sizeof(uint64_t));
+  }
+}
+
+template <class READER> void MolSSSBitmaps::Deserialize(READER &reader) {
+  uint64_t header[3];
+  reader.ReadData(data_ptr_cast(header), sizeof(header));
+  if (header[0] != bitmaps.size()) {
+    throw IOException("MOL_SSS index has %llu screen bits, expected %llu",
+                      header[0], bitmaps.size());
+  }
+  Reserve(header[1]);
+  row_count = header[2];
+  reader.ReadData(data_ptr_cast(bit_counts.data()),
+                  bit_counts.size() * sizeof(idx_t));
+  reader.ReadData(data_ptr_cast(rows.data()), num_words * sizeof(uint64_t));
+  for (auto &bitmap : bitmaps) {
+    reader.ReadData(data_ptr_cast(bitmap.data()), num_words * sizeof(uint64_t));
+  }
+  // the summaries are not stored, they are cheap to recompute
+  ComputeRowGroupSummaries();
+}
+
+//===--------------------------------------------------------------------===//
+// Linked block storage
+//===--------------------------------------------------------------------===//
+// The serialized bitmaps are written to a linked list of fixed size blocks
+// that are allocated from the index block manager, so that they are stored
+// in the database file and written to the WAL like the blocks of an ART.
+struct LinkedBlock {
+  static constexpr const idx_t BLOCK_SIZE =
+      Storage::DEFAULT_BLOCK_SIZE - sizeof(validity_t);
+  static constexpr const idx_t BLOCK_DATA_SIZE =
+      BLOCK_SIZE - sizeof(IndexPointer);
+  static_assert(BLOCK_SIZE > sizeof(IndexPointer),
+                "Block size must be larger than the size of an IndexPointer");
+
+  IndexPointer next_block;
+  char data[BLOCK_DATA_SIZE] = {0};
+};
+
+constexpr idx_t LinkedBlock::BLOCK_DATA_SIZE;
+constexpr idx_t LinkedBlock::BLOCK_SIZE;
+
+class LinkedBlockReader {
+public:
+  LinkedBlockReader(FixedSizeAllocator &allocator, IndexPointer root_pointer)
+      : allocator(allocator), current_pointer(root_pointer),
+        position_in_block(0) {}
+
+  void ReadData(data_ptr_t buffer, idx_t length) {
+    idx_t bytes_read = 0;
+    while (bytes_read < length) {
+      if (!current_pointer.Get()) {
+        throw IOException("MOL_SSS index data is truncated");
+      }
+      auto block = allocator.Get<const LinkedBlock>(current_pointer, false);
+      auto to_read = MinValue<idx_t>(length - bytes_read,
+                                     LinkedBlock::BLOCK_DATA_SIZE -
+                                         position_in_block);
+      memcpy(buffer + bytes_read, block->data + position_in_block, to_read);
+      bytes_read += to_read;
+      position_in_block += to_read;
+      if (position_in_block == LinkedBlock::BLOCK_DATA_SIZE) {
+        position_in_block = 0;
+        current_pointer = block->next_block;
+      }
+    }
+  }
+
+private:
+  FixedSizeAllocator &allocator;
+  IndexPointer current_pointer;
+  idx_t position_in_block;
+};
+
+class LinkedBlockWriter {
+public:
+  LinkedBlockWriter(FixedSizeAllocator &allocator, IndexPointer root_pointer)
+      : allocator(allocator), current_pointer(root_pointer),
+        position_in_block(0) {
+    ClearCurrentBlock();
+  }
+
+  void WriteData(const_data_ptr_t buffer, idx_t length) {
+    idx_t bytes_written = 0;
+    while (bytes_written < length) {
+      auto block = allocator.Get<LinkedBlock>(current_pointer, true);
+      auto to_write = MinValue<idx_t>(length - bytes_written,
+                                      LinkedBlock::BLOCK_DATA_SIZE -
+                                          position_in_block);
+      memcpy(block->data + position_in_block, buffer + bytes_written,
+             to_write);
+      bytes_written += to_write;
+      position_in_block += to_write;
+      if (position_in_block == LinkedBlock::BLOCK_DATA_SIZE) {
+        position_in_block = 0;
+        // reuse the blocks from the previous time the index was written
+        if (!block->next_block.Get()) {
+          block->next_block = allocator.New();
+        }
+        current_pointer = block->next_block;
+        ClearCurrentBlock();
+      }
+    }
+  }
+
+private:
+  void ClearCurrentBlock() {
+    auto block = allocator.Get<LinkedBlock>(current_pointer, true);
+    memset(block->data, 0, LinkedBlock::BLOCK_DATA_SIZE);
+  }
+
+  FixedSizeAllocator &allocator;
+  IndexPointer current_pointer;
+  idx_t position_in_block;
+};
+
+//===--------------------------------------------------------------------===//
+// MolSSSIndex
+//===--------------------------------------------------------------------===//
+MolSSSIndex::MolSSSIndex(
+    const string &name, IndexConstraintType index_constraint_type,
+    const vector<column_t> &column_ids, TableIOManager &table_io_manager,
+    const vector<unique_ptr<Expression>> &unbound_expressions,
+    AttachedDatabase &db, const case_insensitive_map_t<Value> &options,
+    const IndexStorageInfo &info)
+    : BoundIndex(name, TYPE_NAME, index_constraint_type, column_ids,
+                 table_io_manager, unbound_expressions, db),
+      bitmaps(0) {
+  if (index_constraint_type != IndexConstraintType::NONE) {
+    throw NotImplementedException(
+        "MOL_SSS indexes do not support unique or primary key constraints");
+  }
+  ParseOptions(options, screen, screen_bits);
+  bitmaps = MolSSSBitmaps(screen_bits);
+
+  auto &block_manager = table_io_manager.GetIndexBlockManager();
+  linked_block_allocator =
+      make_uniq<FixedSizeAllocator>(sizeof(LinkedBlock), block_manager);
+
+  if (info.IsValid()) {
+    // the index was stored in the database file, load it
+    root_block_ptr.Set(info.root);
+    D_ASSERT(info.allocator_infos.size() == 1);
+    linked_block_allocator->Init(info.allocator_infos[0]);
+    if (!info.allocator_infos[0].buffer_ids.empty()) {
+      LinkedBlockReader reader(*linked_block_allocator, root_block_ptr);
+      bitmaps.Deserialize(reader);
+    }
+  }
+}
+
+void MolSSSIndex::ParseOptions(const case_insensitive_map_t<Value> &options,
+                               MolSSSScreen &screen, idx_t &screen_bits) {
+  screen = MolSSSScreen::DALKE;
+  screen_bits = DEFAULT_PATTERN_BITS;
+  bool has_bits = false;
+  for (auto &option : options) {
+    if (option.first == "fingerprint") {
+      auto fingerprint = StringUtil::Lower(option.second.ToString());
+      if (fingerprint == "dalke") {
+        screen = MolSSSScreen::DALKE;
+      } else if (fingerprint == "pattern") {
+        screen = MolSSSScreen::PATTERN;
+      } else {
+        throw BinderException(
+            "MOL_SSS index 'fingerprint' must be 'dalke' or 'pattern', "
+            "got '%s'",
+            fingerprint);
+      }
+    } else if (option.first == "bits") {
+      auto bits = option.second.GetValue<int64_t>();
+      if (bits <= 0 || bits % WORD_BITS != 0) {
+        throw BinderException(
+            "MOL_SSS index 'bits' must be a positive multiple of %llu",
+            WORD_BITS);
+      }
+      screen_bits = idx_t(bits);
+      has_bits = true;
+    } else {
+      throw BinderException("Unknown option for MOL_SSS index: '%s'",
+                            option.first);
+    }
+  }
+  if (screen == MolSSSScreen::DALKE) {
+    if (has_bits) {
+      throw BinderException(
+          "MOL_SSS index 'bits' can only be set with fingerprint = 'pattern', "
+          "the 'dalke' fingerprint always has 55 bits");
+    }
+    // the number of bits that make_dalke_fp sets
+    screen_bits = 55;
+  }
+}
+
+std::vector<idx_t> MolSSSIndex::ComputeScreen(MolSSSScreen screen,
+                                              idx_t screen_bits,
+                                              umbra_mol_t umbra_mol) {
+  std::vector<idx_t> result;
+  if (screen == MolSSSScreen::DALKE) {
+    // the dalke fp is already in the umbra_mol, the molecule does not need
+    // to be deserialized
+    auto fp = umbra_mol.GetDalkeFP();
+    while (fp) {
+      result.push_back(CountZeros<uint64_t>::Trailing(fp));
+      fp &= fp - 1;
+    }
+    return result;
+  }
+
+  auto mol = rdkit_umbra_mol_to_mol(umbra_mol);
+  std::unique_ptr<ExplicitBitVect> fp(
+      RDKit::PatternFingerprintMol(*mol, screen_bits));
+  std::vector<int> on_bits;
+  fp->getOnBits(on_bits);
+  result.assign(on_bits.begin(), on_bits.end());
+  return result;
+}
+
+std::vector<row_t> MolSSSIndex::Search(umbra_mol_t query) {
+  auto query_screen = ComputeScreen(query);
+  lock_guard<mutex> guard(bitmaps_lock);
+  return bitmaps.Search(query_screen);
+}
+
+idx_t MolSSSIndex::EstimateCardinality(umbra_mol_t query) {
+  auto query_screen = ComputeScreen(query);
+  lock_guard<mutex> guard(bitmaps_lock);
+  auto row_groups = bitmaps.CountCandidateRowGroups(query_screen);
+  return MinValue(bitmaps.GetRowCount(), row_groups * DEFAULT_ROW_GROUP_SIZE);
+}
+
+void MolSSSIndex::Build(MolSSSBitmaps new_bitmaps) {
+  lock_guard<mutex> guard(bitmaps_lock);
+  bitmaps = std::move(new_bitmaps);
+  is_dirty = true;
+}
+
+ErrorData MolSSSIndex::Append(IndexLock &lock, DataChunk &entries,
+                              Vector &row_identifiers) {
+  DataChunk expression_result;
+  expression_result.Initialize(Allocator::DefaultAllocator(), logical_types);
+  ExecuteExpressions(entries, expression_result);
+  return Insert(lock, expression_result, row_identifiers);
+}
+
+ErrorData MolSSSIndex::Insert(IndexLock &lock, DataChunk &data,
+                              Vector &row_ids) {
+  auto count = data.size();
+  UnifiedVectorFormat mol_format;
+  UnifiedVectorFormat row_format;
+  data.data[0].ToUnifiedFormat(count, mol_format);
+  row_ids.ToUnifiedFormat(count, row_format);
+  auto mols = UnifiedVectorFormat::GetData<string_t>(mol_format);
+  auto rows = UnifiedVectorFormat::GetData<row_t>(row_format);
+
+  // compute the screens before taking the lock, the pattern fingerprint
+  // needs the molecule to be deserialized
+  std::vector<std::pair<row_t, std::vector<idx_t>>> screens;
+  screens.reserve(count);
+  for (idx_t i = 0; i < count; i++) {
+    auto mol_idx = mol_format.sel->get_index(i);
+    if (!mol_format.validity.RowIsValid(mol_idx)) {
+      continue;
+    }
+    auto mol = mols[mol_idx];
+    auto row_id = rows[row_format.sel->get_index(i)];
+    if (row_id >= MAX_ROW_ID) {
+      throw InternalException(
+          "MOL_SSS index cannot contain transaction local rows");
+    }
+    screens.emplace_back(row_id, ComputeScreen(umbra_mol_t(mol)));
+  }
+
+  lock_guard<mutex> guard(bitmaps_lock);
+  for (auto &entry : screens) {
+    bitmaps.Add(entry.first, entry.second);
+  }
+  is_dirty = true;
+  return ErrorData();
+}
+
+void MolSSSIndex::Delete(IndexLock &lock, DataChunk &entries,
+                         Vector &row_identifiers) {
+  auto count = entries.size();
+  UnifiedVectorFormat row_format;
+  row_identifiers.ToUnifiedFormat(count, row_format);
+  auto rows = UnifiedVectorFormat::GetData<row_t>(row_format);
+
+  lock_guard<mutex> guard(bitmaps_lock);
+  for (idx_t i = 0; i < count; i++) {
+    bitmaps.Remove(rows[row_format.sel->get_index(i)]);
+  }
+  is_dirty = true;
+}
+
+void MolSSSIndex::CommitDrop(IndexLock &index_lock) {
+  lock_guard<mutex> guard(bitmaps_lock);
+  bitmaps = MolSSSBitmaps(screen_bits);
+  linked_block_allocator->Reset();
+  root_block_ptr.Clear();
+}
+
+void MolSSSIndex::PersistToDisk() {
+  lock_guard<mutex> guard(bitmaps_lock);
+  if (!is_dirty) {
+    return;
+  }
+  if (!root_block_ptr.Get()) {
+    root_block_ptr = linked_block_allocator->New();
+  }
+  LinkedBlockWriter writer(*linked_block_allocator, root_block_ptr);
+  bitmaps.Serialize(writer);
+  is_dirty = false;
+}
+
+IndexStorageInfo
+MolSSSIndex::GetStorageInfo(const case_insensitive_map_t<Value> &options,
+                            const bool to_wal) {
+  PersistToDisk();
+
+  IndexStorageInfo info;
+  info.name = name;
+  info.root = root_block_ptr.Get();
+  info.options = options;
+
+  auto &allocator = *linked_block_allocator;
+  if (!to_wal) {
+    // write all the blocks of the allocator to the database file
+    auto &block_manager = table_io_manager.GetIndexBlockManager();
+    PartialBlockManager partial_block_manager(block_manager,
+                                              PartialBlockType::FULL_CHECKPOINT);
+    allocator.SerializeBuffers(partial_block_manager);
+    partial_block_manager.FlushPartialBlocks();
+  } else {
+    info.buffers.push_back(allocator.InitSerializationToWAL());
+  }
+  info.allocator_infos.push_back(allocator.GetInfo());
+  return info;
+}
+
+idx_t MolSSSIndex::GetInMemorySize(IndexLock &state) {
+  lock_guard<mutex> guard(bitmaps_lock);
+  return bitmaps.GetInMemorySize() +
+         linked_block_allocator->GetInMemorySize();
+}
+
+bool MolSSSIndex::MergeIndexes(IndexLock &state, BoundIndex &other_index) {
+  auto &other = other_index.Cast<MolSSSIndex>();
+  if (other.screen != screen || other.screen_bits != screen_bits) {
+    return false;
+  }
+  lock_guard<mutex> guard(bitmaps_lock);
+  lock_guard<mutex> other_guard(other.bitmaps_lock);
+  bitmaps.Merge(other.bitmaps);
+  is_dirty = true;
+  return true;
+}
+
+void MolSSSIndex::Vacuum(IndexLock &state) {}
+
+string MolSSSIndex::VerifyAndToString(IndexLock &state,
+                                      const bool only_verify) {
+  lock_guard<mutex> guard(bitmaps_lock);
+  return StringUtil::Format("MOL_SSS index: %llu rows, %llu screen bits",
+                            bitmaps.GetRowCount(), bitmaps.GetScreenBits());
+}
+
+void MolSSSIndex::VerifyAllocations(IndexLock &state) {}
+
+//===--------------------------------------------------------------------===//
+// CREATE INDEX
+//===--------------------------------------------------------------------===//
+PhysicalOperator &MolSSSIndex::CreatePlan(PlanIndexInput &input) {
+  auto &create_index = input.op;
+
+  if (create_index.info->constraint_type != IndexConstraintType::NONE) {
+    throw BinderException(
+        "MOL_SSS indexes do not support unique or primary key constraints");
+  }
+  if (create_index.expressions.size() != 1 ||
+      create_index.unbound_expressions[0]->type !=
+          ExpressionType::BOUND_COLUMN_REF ||
+      create_index.expressions[0]->return_type != Mol()) {
+    throw BinderException(
+        "MOL_SSS indexes can only be created on a single Mol column");
+  }
+  // throws if the options are invalid
+  MolSSSScreen screen;
+  idx_t screen_bits;
+  ParseOptions(create_index.info->options, screen, screen_bits);
+
+  // project the indexed column and the row id
+  vector<LogicalType> new_column_types;
+  vector<unique_ptr<Expression>> select_list;
+  for (auto &expression : create_index.expressions) {
+    new_column_types.push_back(expression->return_type);
+    select_list.push_back(std::move(expression));
+  }
+  new_column_types.emplace_back(LogicalType::ROW_TYPE);
+  select_list.push_back(make_uniq<BoundReferenceExpression>(
+      LogicalType::ROW_TYPE, create_index.info->scan_types.size() - 1));
+
+  auto &projection = input.planner.Make<PhysicalProjection>(
+      new_column_types, std::move(select_list),
+      create_index.estimated_cardinality);
+  projection.children.push_back(input.table_scan);
+
+  auto &physical_create_index = input.planner.Make<PhysicalCreateMolSSSIndex>(
+      create_index.types, create_index.table, create_index.info->column_ids,
+      std::move(create_index.info), std::move(create_index.unbound_expressions),
+      create_index.estimated_cardinality);
+  physical_create_index.children.push_back(projection);
+  return physical_create_index;
+}
+
+void RegisterMolSSSIndex(ExtensionLoader &loader) {
+  IndexType index_type;
+  index_type.name = MolSSSIndex::TYPE_NAME;
+  index_type.create_instance =
+      [](CreateIndexInput &input) -> unique_ptr<BoundIndex> {
+    return make_uniq<MolSSSIndex>(input.name, input.constraint_type,
+                                  input.column_ids, input.table_io_manager,
+                                  input.unbound_expressions, input.db,
+                                  input.options, input.storage_info);
+  };
+  index_type.create_plan = MolSSSIndex::CreatePlan;
+
+  auto &db = loader.GetDatabaseInstance();
+  db.config.GetIndexTypes().RegisterIndexType(index_type);
+
+  RegisterMolSSSIndexScan(loader);
+}
+
+} // namespace duckdb
@@ -0,0 +1,362 @@
+#include "mol_sss_index/mol_sss_index_scan.hpp"
+#include "common.hpp"
+#include "duckdb/catalog/catalog_entry/duck_table_entry.hpp"
+#include "duckdb/execution/expression_executor.hpp"
+#include "duckdb/main/config.hpp"
+#include "duckdb/optimizer/optimizer_extension.hpp"
+#include "duckdb/planner/expression/bound_columnref_expression.hpp"
+#include "duckdb/planner/expression/bound_conjunction_expression.hpp"
+#include "duckdb/planner/expression/bound_function_expression.hpp"
+#include "duckdb/planner/operator/logical_filter.hpp"
+#include "duckdb/planner/operator/logical_get.hpp"
+#include "duckdb/storage/data_table.hpp"
+#include "duckdb/storage/table/scan_state.hpp"
+#include "duckdb/transaction/duck_transaction.hpp"
+#include "duckdb/transaction/local_storage.hpp"
+#include "mol_sss_index/mol_sss_index.hpp"
+#include "umbra_mol.hpp"
+
+namespace duckdb {
+
+//===--------------------------------------------------------------------===//
+// Bind
+//===--------------------------------------------------------------------===//
+struct MolSSSIndexScanBindData : public TableFunctionData {
+  MolSSSIndexScanBindData(DuckTableEntry &table, MolSSSIndex &index,
+                          std::string query)
+      : table(table), index(index), query(std::move(query)) {}
+
+  DuckTableEntry &table;
+  MolSSSIndex &index;
+  // the umbra_mol of the substructure query
+  std::string query;
+
+  unique_ptr<FunctionData> Copy() const override {
+    return make_uniq<MolSSSIndexScanBindData>(table, index, query);
+  }
+
+  bool Equals(const FunctionData &other_p) const override {
+    auto &other = other_p.Cast<MolSSSIndexScanBindData>();
+    return &other.table == &table && &other.index == &index &&
+           other.query == query;
+  }
+};
+
+//===--------------------------------------------------------------------===//
+// Global state
+//===--------------------------------------------------------------------===//
+// A row group with at least 1 / SEQUENTIAL_SCAN_DIVISOR of its rows as
+// candidates is scanned sequentially, instead of fetching the candidates one
+// by one. The is_substruct filter above the scan drops the rows that are not
+// candidates
+static constexpr idx_t SEQUENTIAL_SCAN_DIVISOR = 8;
+
+// Rows of the table to read: either a range of rows that is scanned
+// sequentially, or candidates that are fetched
+struct MolSSSCandidateRange {
+  bool sequential;
+  // the rows of the range, for a sequential scan
+  idx_t start_row;
+  idx_t end_row;
+  // the candidates of the range, indexes into row_ids
+  idx_t begin;
+  idx_t end;
+};
+
+struct MolSSSIndexScanGlobalState : public GlobalTableFunctionState {
+  // the candidate rows from the index, in ascending order
+  std::vector<row_t> row_ids;
+  // the row groups that have candidates. Row groups without candidates are
+  // not read at all
+  std::vector<MolSSSCandidateRange> ranges;
+  idx_t range_idx = 0;
+  // the next candidate to fetch, an index into row_ids
+  idx_t offset = 0;
+  // the scan of the current sequential range, nullptr if it is not started
+  unique_ptr<TableScanState> scan_state;
+
+  ColumnFetchState fetch_state;
+  vector<StorageIndex> column_ids;
+  // if not all the fetched columns are in the output
+  vector<idx_t> projection_ids;
+  DataChunk all_columns;
+};
+
+// Groups the candidates by row group. Dense row groups are scanned
+// sequentially, adjacent ones as one range
+static std::vector<MolSSSCandidateRange>
+GetCandidateRanges(const std::vector<row_t> &row_ids, idx_t total_rows) {
+  std::vector<MolSSSCandidateRange> ranges;
+  idx_t begin = 0;
+  while (begin < row_ids.size()) {
+    auto row_group = idx_t(row_ids[begin]) / DEFAULT_ROW_GROUP_SIZE;
+    auto start_row = row_group * DEFAULT_ROW_GROUP_SIZE;
+    auto end_row = MinValue(start_row + DEFAULT_ROW_GROUP_SIZE, total_rows);
+    idx_t end = begin;
+    while (end < row_ids.size() && idx_t(row_ids[end]) < end_row) {
+      end++;
+    }
+    bool sequential =
+        (end - begin) * SEQUENTIAL_SCAN_DIVISOR >= end_row - start_row;
+    if (sequential && !ranges.empty() && ranges.back().sequential &&
+        ranges.back().end_row == start_row) {
+      ranges.back().end_row = end_row;
+      ranges.back().end = end;
+    } else {
+      ranges.push_back({sequential, start_row, end_row, begin, end});
+    }
+    begin = end;
+  }
+  return ranges;
+}
+
+static unique_ptr<GlobalTableFunctionState>
+MolSSSIndexScanInitGlobal(ClientContext &context,
+                          TableFunctionInitInput &input) {
+  auto &bind_data = input.bind_data->Cast<MolSSSIndexScanBindData>();
+  auto result = make_uniq<MolSSSIndexScanGlobalState>();
+
+  vector<LogicalType> column_types;
+  for (auto &id : input.column_ids) {
+    storage_t col_id = id;
+    if (id == COLUMN_IDENTIFIER_ROW_ID) {
+      column_types.push_back(LogicalType::ROW_TYPE);
+    } else {
+      auto &column = bind_data.table.GetColumn(LogicalIndex(id));
+      col_id = column.StorageOid();
+      column_types.push_back(column.Type());
+    }
+    result->column_ids.emplace_back(col_id);
+  }
+  if (!input.projection_ids.empty() &&
+      input.projection_ids.size() != input.column_ids.size()) {
+    result->projection_ids = input.projection_ids;
+    result->all_columns.Initialize(context, column_types);
+  }
+
+  string_t query(bind_data.query.data(), bind_data.query.size());
+  result->row_ids = bind_data.index.Search(umbra_mol_t(query));
+  result->ranges = GetCandidateRanges(
+      result->row_ids, bind_data.table.GetStorage().GetTotalRows());
+  return std::move(result);
+}
+
+//===--------------------------------------------------------------------===//
+// Execute
+//===--------------------------------------------------------------------===//
+// Reads the next rows of the current range into chunk. Returns false when
+// the range is done
+static bool ReadCandidateRange(DataTable &storage, DuckTransaction &transaction,
+                               MolSSSIndexScanGlobalState &state,
+                               DataChunk &chunk) {
+  auto &range = state.ranges[state.range_idx];
+  if (range.sequential) {
+    if (!state.scan_state) {
+      state.scan_state = make_uniq<TableScanState>();
+      storage.InitializeScanWithOffset(transaction, *state.scan_state,
+                                       state.column_ids, range.start_row,
+                                       range.end_row);
+    }
+    // the scan skips the rows that are not visible to this transaction
+    storage.Scan(transaction, chunk, *state.scan_state);
+    if (chunk.size() == 0) {
+      state.scan_state.reset();
+      return false;
+    }
+    return true;
+  }
+
+  if (state.offset < range.begin) {
+    state.offset = range.begin;
+  }
+  if (state.offset >= range.end) {
+    return false;
+  }
+  auto count = MinValue<idx_t>(STANDARD_VECTOR_SIZE, range.end - state.offset);
+  Vector row_ids(LogicalType::ROW_TYPE,
+                 data_ptr_cast(state.row_ids.data() + state.offset));
+  state.offset += count;
+  // Fetch skips the rows that are not visible to this transaction
+  storage.Fetch(transaction, chunk, state.column_ids, row_ids, count,
+                state.fetch_state);
+  return true;
+}
+
+static void MolSSSIndexScanExecute(ClientContext &context,
+                                   TableFunctionInput &data_p,
+                                   DataChunk &output) {
+  auto &bind_data = data_p.bind_data->Cast<MolSSSIndexScanBindData>();
+  auto &state = data_p.global_state->Cast<MolSSSIndexScanGlobalState>();
+  auto &storage = bind_data.table.GetStorage();
+  auto &transaction = DuckTransaction::Get(context, bind_data.table.catalog);
+
+  // keep going until some rows are read or the ranges run out
+  auto &chunk = state.projection_ids.empty() ? output : state.all_columns;
+  while (state.range_idx < state.ranges.size()) {
+    chunk.Reset();
+    if (!ReadCandidateRange(storage, transaction, state, chunk)) {
+      state.range_idx++;
+      continue;
+    }
+    if (chunk.size() == 0) {
+      continue;
+    }
+    if (!state.projection_ids.empty()) {
+      output.ReferenceColumns(state.all_columns, state.projection_ids);
+    }
+    return;
+  }
+  output.SetCardinality(0);
+}
+
+static unique_ptr<NodeStatistics>
+MolSSSIndexScanCardinality(ClientContext &context,
+                           const FunctionData *bind_data_p) {
+  auto &bind_data = bind_data_p->Cast<MolSSSIndexScanBindData>();
+  auto &storage = bind_data.table.GetStorage();
+  string_t query(bind_data.query.data(), bind_data.query.size());
+  auto estimate = bind_data.index.EstimateCardinality(umbra_mol_t(query));
+  return make_uniq<NodeStatistics>(estimate, storage.GetTotalRows());
+}
+
+static BindInfo
+MolSSSIndexScanBindInfo(const optional_ptr<FunctionData> bind_data_p) {
+  auto &bind_data = bind_data_p->Cast<MolSSSIndexScanBindData>();
+  return BindInfo(bind_data.table);
+}
+
+static InsertionOrderPreservingMap<string>
+MolSSSIndexScanToString(TableFunctionToStringInput &input) {
+  InsertionOrderPreservingMap<string> result;
+  auto &bind_data = input.bind_data->Cast<MolSSSIndexScanBindData>();
+  result["Table"] = bind_data.table.name;
+  result["MOL_SSS Index"] = bind_data.index.GetIndexName();
+  return result;
+}
+
+TableFunction MolSSSIndexScanFunction::GetFunction() {
+  TableFunction func("mol_sss_index_scan", {}, MolSSSIndexScanExecute);
+  func.init_global = MolSSSIndexScanInitGlobal;
+  func.cardinality = MolSSSIndexScanCardinality;
+  func.get_bind_info = MolSSSIndexScanBindInfo;
+  func.to_string = MolSSSIndexScanToString;
+  func.projection_pushdown = true;
+  // the is_substruct filter stays above the scan
+  func.filter_pushdown = false;
+  return func;
+}
+
+//===--------------------------------------------------------------------===//
+// Optimizer
+//===--------------------------------------------------------------------===//
+static void CollectConjuncts(Expression &expr,
+                             vector<reference<Expression>> &conjuncts) {
+  if (expr.type == ExpressionType::CONJUNCTION_AND) {
+    for (auto &child : expr.Cast<BoundConjunctionExpression>().children) {
+      CollectConjuncts(*child, conjuncts);
+    }
+    return;
+  }
+  conjuncts.push_back(expr);
+}
+
+// Replaces the table scan under the filter with a MOL_SSS index scan if
+// the filter has is_substruct(indexed_column, <constant>)
+static void TryUseMolSSSIndex(ClientContext &context, LogicalFilter &filter,
+                              LogicalGet &get) {
+  if (get.function.name != "seq_scan") {
+    return;
+  }
+  auto table_entry = get.GetTable();
+  if (!table_entry || !table_entry->IsDuckTable()) {
+    return;
+  }
+  auto &table = table_entry->Cast<DuckTableEntry>();
+  auto &storage = table.GetStorage();
+  // the rows inserted by this transaction are only added to the index when
+  // it commits
+  auto &local_storage = LocalStorage::Get(context, table.catalog);
+  if (local_storage.AddedRows(storage) > 0) {
+    return;
+  }
+
+  vector<reference<Expression>> conjuncts;
+  for (auto &expr : filter.expressions) {
+    CollectConjuncts(*expr, conjuncts);
+  }
+
+  for (auto &conjunct : conjuncts) {
+    auto &expr = conjunct.get();
+    if (expr.expression_class != ExpressionClass::BOUND_FUNCTION) {
+      continue;
+    }
+    auto &func = expr.Cast<BoundFunctionExpression>();
+    if (func.function.name != "is_substruct" || func.children.size() != 2 ||
+        func.children[0]->type != ExpressionType::BOUND_COLUMN_REF ||
+        !func.children[1]->IsFoldable()) {
+      continue;
+    }
+    auto &colref = func.children[0]->Cast<BoundColumnRefExpression>();
+    if (colref.binding.table_index != get.table_index) {
+      continue;
+    }
+    auto &column_index = get.GetColumnIds()[colref.binding.column_index];
+    if (column_index.IsRowIdColumn()) {
+      continue;
+    }
+    auto storage_id =
+        table.GetColumn(LogicalIndex(column_index.GetPrimaryIndex()))
+            .StorageOid();
+
+    auto query = ExpressionExecutor::EvaluateScalar(context, *func.children[1]);
+    if (query.IsNull()) {
+      continue;
+    }
+
+    optional_ptr<MolSSSIndex> index;
+    storage.GetDataTableInfo()->GetIndexes().BindAndScan<MolSSSIndex>(
+        context, *storage.GetDataTableInfo(), [&](MolSSSIndex &mol_sss_index) {
+          if (mol_sss_index.GetColumnIds()[0] != storage_id) {
+            return false;
+          }
+          index = &mol_sss_index;
+          return true;
+        });
+    if (!index) {
+      continue;
+    }
+
+    get.function = MolSSSIndexScanFunction::GetFunction();
+    get.bind_data = make_uniq<MolSSSIndexScanBindData>(
+        table, *index, StringValue::Get(query));
+    return;
+  }
+}
+
+static void OptimizeMolSSSIndexScan(ClientContext &context,
+                                    unique_ptr<LogicalOperator> &plan) {
+  if (plan->type == LogicalOperatorType::LOGICAL_FILTER &&
+      plan->children[0]->type == LogicalOperatorType::LOGICAL_GET) {
+    TryUseMolSSSIndex(context, plan->Cast<LogicalFilter>(),
+                      plan->children[0]->Cast<LogicalGet>());
+  }
+  for (auto &child : plan->children) {
+    OptimizeMolSSSIndexScan(context, child);
+  }
+}
+
+// This runs before the built in optimizers, so that the is_substruct filter
+// is still directly above the table scan
+static void MolSSSIndexScanPreOptimize(OptimizerExtensionInput &input,
+                                       unique_ptr<LogicalOperator> &plan) {
+  OptimizeMolSSSIndexScan(input.context, plan);
+}
+
+void RegisterMolSSSIndexScan(ExtensionLoader &loader) {
+  OptimizerExtension optimizer;
+  optimizer.pre_optimize_function = MolSSSIndexScanPreOptimize;
+  auto &config = DBConfig::GetConfig(loader.GetDatabaseInstance());
+  config.optimizer_extensions.push_back(std::move(optimizer));
+}
+
+} // namespace duckdb
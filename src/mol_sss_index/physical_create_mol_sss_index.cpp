@@ -0,0 +1,138 @@
+#include "mol_sss_index/physical_create_mol_sss_index.hpp"
+#include "common.hpp"
+#include "duckdb/catalog/catalog_entry/duck_index_entry.hpp"
+#include "duckdb/catalog/catalog_entry/duck_schema_entry.hpp"
+#include "duckdb/storage/data_table.hpp"
+#include "duckdb/storage/table_io_manager.hpp"
+#include "mol_sss_index/mol_sss_index.hpp"
+#include "umbra_mol.hpp"
+
+namespace duckdb {
+
+PhysicalCreateMolSSSIndex::PhysicalCreateMolSSSIndex(
+    PhysicalPlan &physical_plan, const vector<LogicalType> &types_p,
+    TableCatalogEntry &table_p, const vector<column_t> &column_ids,
+    unique_ptr<CreateIndexInfo> info,
+    vector<unique_ptr<Expression>> unbound_expressions,
+    idx_t estimated_cardinality)
+    : PhysicalOperator(physical_plan, PhysicalOperatorType::EXTENSION, types_p,
+                       estimated_cardinality),
+      table(table_p.Cast<DuckTableEntry>()), info(std::move(info)),
+      unbound_expressions(std::move(unbound_expressions)) {
+  // convert the logical column ids to physical column ids
+  for (auto &column_id : column_ids) {
+    storage_ids.push_back(
+        table.GetColumns().LogicalToPhysical(LogicalIndex(column_id)).index);
+  }
+}
+
+class CreateMolSSSIndexGlobalState : public GlobalSinkState {
+public:
+  CreateMolSSSIndexGlobalState(MolSSSScreen screen, idx_t screen_bits)
+      : screen(screen), screen_bits(screen_bits), bitmaps(screen_bits) {}
+
+  MolSSSScreen screen;
+  idx_t screen_bits;
+  mutex lock;
+  MolSSSBitmaps bitmaps;
+};
+
+class CreateMolSSSIndexLocalState : public LocalSinkState {
+public:
+  explicit CreateMolSSSIndexLocalState(idx_t screen_bits)
+      : bitmaps(screen_bits) {}
+
+  MolSSSBitmaps bitmaps;
+};
+
+unique_ptr<GlobalSinkState>
+PhysicalCreateMolSSSIndex::GetGlobalSinkState(ClientContext &context) const {
+  MolSSSScreen screen;
+  idx_t screen_bits;
+  MolSSSIndex::ParseOptions(info->options, screen, screen_bits);
+  return make_uniq<CreateMolSSSIndexGlobalState>(screen, screen_bits);
+}
+
+unique_ptr<LocalSinkState>
+PhysicalCreateMolSSSIndex::GetLocalSinkState(ExecutionContext &context) const {
+  auto &gstate = sink_state->Cast<CreateMolSSSIndexGlobalState>();
+  return make_uniq<CreateMolSSSIndexLocalState>(gstate.screen_bits);
+}
+
+SinkResultType PhysicalCreateMolSSSIndex::Sink(ExecutionContext &context,
+                                               DataChunk &chunk,
+                                               OperatorSinkInput &input) const {
+  auto &gstate = input.global_state.Cast<CreateMolSSSIndexGlobalState>();
+  auto &lstate = input.local_state.Cast<CreateMolSSSIndexLocalState>();
+
+  auto count = chunk.size();
+  UnifiedVectorFormat mol_format;
+  UnifiedVectorFormat row_format;
+  chunk.data[0].ToUnifiedFormat(count, mol_format);
+  chunk.data[1].ToUnifiedFormat(count, row_format);
+  auto mols = UnifiedVectorFormat::GetData<string_t>(mol_format);
+  auto rows = UnifiedVectorFormat::GetData<row_t>(row_format);
+
+  for (idx_t i = 0; i < count; i++) {
+    auto mol_idx = mol_format.sel->get_index(i);
+    // NULL molecules are not in the index, they never match is_substruct
+    if (!mol_format.validity.RowIsValid(mol_idx)) {
+      continue;
+    }
+    auto mol = mols[mol_idx];
+    auto screen = MolSSSIndex::ComputeScreen(gstate.screen, gstate.screen_bits,
+                                             umbra_mol_t(mol));
+    lstate.bitmaps.Add(rows[row_format.sel->get_index(i)], screen);
+  }
+  return SinkResultType::NEED_MORE_INPUT;
+}
+
+SinkCombineResultType
+PhysicalCreateMolSSSIndex::Combine(ExecutionContext &context,
+                                   OperatorSinkCombineInput &input) const {
+  auto &gstate = input.global_state.Cast<CreateMolSSSIndexGlobalState>();
+  auto &lstate = input.local_state.Cast<CreateMolSSSIndexLocalState>();
+  lock_guard<mutex> guard(gstate.lock);
+  gstate.bitmaps.Merge(lstate.bitmaps);
+  return SinkCombineResultType::FINISHED;
+}
+
+SinkFinalizeType
+PhysicalCreateMolSSSIndex::Finalize(Pipeline &pipeline, Event &event,
+                                    ClientContext &context,
+                                    OperatorSinkFinalizeInput &input) const {
+  auto &gstate = input.global_state.Cast<CreateMolSSSIndexGlobalState>();
+
+  auto &storage = table.GetStorage();
+  if (!storage.IsMainTable()) {
+    throw TransactionException(
+        "Transaction conflict: cannot add an index to a table that has been "
+        "altered!");
+  }
+
+  auto &schema = table.schema;
+  info->column_ids = storage_ids;
+  auto index_entry =
+      schema.CreateIndex(schema.GetCatalogTransaction(context), *info, table);
+  if (!index_entry) {
+    // the index already exists, and IF NOT EXISTS was used
+    D_ASSERT(info->on_conflict == OnCreateConflict::IGNORE_ON_CONFLICT);
+    return SinkFinalizeType::READY;
+  }
+
+  auto index = make_uniq<MolSSSIndex>(
+      info->index_name, info->constraint_type, storage_ids,
+      TableIOManager::Get(storage), unbound_expressions, storage.db,
+      info->options);
+  index->Build(std::move(gstate.bitmaps));
+
+  auto &duck_index = index_entry->Cast<DuckIndexEntry>();
+  IndexLock index_lock;
+  index->InitializeLock(index_lock);
+  duck_index.initial_index_size = index->GetInMemorySize(index_lock);
+
+  storage.AddIndex(std::move(index));
+  return SinkFinalizeType::READY;
+}
+
+} // namespace duckdb
@@ -1,60 +1,115 @@
 #include "qed.hpp"
-#include "mol_formats.hpp"
-#include <GraphMol/ChemTransforms/ChemTransforms.h>
 #include <GraphMol/Descriptors/MolDescriptors.h>
-#include <GraphMol/GeneralizedSubstruct/XQMol.h>
 #include <GraphMol/GraphMol.h>
-#include <GraphMol/MolOps.h>
 #include <GraphMol/SmilesParse/SmilesParse.h>
 #include <GraphMol/Substruct/SubstructMatch.h>
+#include <cmath>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <vector>
 
 namespace duckdb {
 
-std::vector<RDKit::RWMol> QED::smarts2mols(std::vector<std::string> smarts) {
+constexpr QED::ADSparameter QED::adsParameters[];
+constexpr float QED::WEIGHT_MEAN[];
+
+QED::QED() {
+  acceptorMols = smarts2mols(acceptorSmarts());
+  alertMols = smarts2mols(structuralAlertSmarts());
+  std::unique_ptr<RDKit::RWMol> mol(RDKit::SmartsToMol(aliphaticRingSmarts));
+  aliphaticRingsMol = *mol;
+}
+
+const QED &QED::Get() {
+  static const QED qed;
+  return qed;
+}
+
+std::vector<RDKit::RWMol>
+QED::smarts2mols(const std::vector<std::string> &smarts) {
   std::vector<RDKit::RWMol> mols;
-  for (auto s : smarts) {
-    std::unique_ptr<RDKit::RWMol> mol;
-    mol.reset(RDKit::SmartsToMol(s));
+  mols.reserve(smarts.size());
+  for (auto &s : smarts) {
+    std::unique_ptr<RDKit::RWMol> mol(RDKit::SmartsToMol(s));
     mols.push_back(*mol);
   }
   return mols;
 }
 
-double QED::calcADS(float x, std::string adsParameterKey) {
-  auto p = QED::adsParameters[adsParameterKey];
+double QED::calcADS(float x, Property property) {
+  auto &p = adsParameters[property];
   auto exp1 = 1 + std::exp(-1 * (x - p.C + p.D / 2) / p.E);
   auto exp2 = 1 + std::exp(-1 * (x - p.C - p.D / 2) / p.F);
   auto dx = p.A + p.B / exp1 * (1 - 1 / exp2);
   return dx / p.DMAX;
 }
 
-QED::QEDproperties
-QED::calcProperties(const RDKit::ROMol &mol,
-                    std::vector<RDKit::RWMol> acceptorMols,
-                    std::unique_ptr<RDKit::RWMol> aliphaticRingMol,
-                    std::vector<RDKit::RWMol> alertMols) {
-  auto molWithoutHs = RDKit::MolOps::removeHs(mol);
-  auto amw = RDKit::Descriptors::calcAMW(mol);
-  double crippenLogP = 0;
-  double _mr = 0;
-  RDKit::Descriptors::calcCrippenDescriptors(mol, crippenLogP, _mr);
+// The RDKit implementation deletes the aliphatic ring atoms from a copy of
+// the molecule and counts the SSSR of what is left. The size of the SSSR is
+// the cyclomatic number of the graph (bonds - atoms + connected components),
+// so the rings are counted on the remaining atoms and bonds directly, without
+// copying the molecule.
+unsigned int QED::calcAromaticRings(const RDKit::ROMol &mol,
+                                    Buffers &buffers) const {
+  auto num_atoms = mol.getNumAtoms();
+  auto &deleted = buffers.deleted;
+  deleted.assign(num_atoms, false);
+  RDKit::SubstructMatch(mol, aliphaticRingsMol, buffers.matches);
+  for (auto &match : buffers.matches) {
+    for (auto &atom : match) {
+      deleted[atom.second] = true;
+    }
+  }
+
+  // union-find over the remaining atoms to count the connected components
+  auto &parents = buffers.parents;
+  parents.resize(num_atoms);
+  std::iota(parents.begin(), parents.end(), 0);
+  auto find = [&](unsigned int atom) {
+    while (parents[atom] != atom) {
+      parents[atom] = parents[parents[atom]];
+      atom = parents[atom];
+    }
+    return atom;
+  };
+
+  int num_remaining_atoms = 0;
+  for (unsigned int atom = 0; atom < num_atoms; atom++) {
+    num_remaining_atoms += !deleted[atom];
+  }
+  int num_components = num_remaining_atoms;
+  int num_remaining_bonds = 0;
+  for (auto bond : mol.bonds()) {
+    auto begin = bond->getBeginAtomIdx();
+    auto end = bond->getEndAtomIdx();
+    if (deleted[begin] || deleted[end]) {
+      continue;
+    }
+    num_remaining_bonds++;
+    auto begin_root = find(begin);
+    auto end_root = find(end);
+    if (begin_root != end_root) {
+      parents[begin_root] = end_root;
+      num_components--;
+    }
+  }
+  return num_remaining_bonds - num_remaining_atoms + num_components;
+}
 
+QED::QEDproperties QED::calcProperties(const RDKit::ROMol &mol, double amw,
+                                       double crippenLogP, unsigned int hbd,
+                                       double psa, Buffers &buffers) const {
   // find all hydrogen bond acceptors
-  RDKit::MatchVectType matchVect;
+  auto &matchVect = buffers.matchVect;
   auto hba = 0;
-  for (auto m : acceptorMols) {
-    bool match = RDKit::SubstructMatch(mol, m, matchVect);
+  for (auto &m : acceptorMols) {
+    RDKit::SubstructMatch(mol, m, matchVect);
     hba += matchVect.size();
   }
 
-  auto hbd = RDKit::Descriptors::calcNumHBD(mol);
-  auto psa = RDKit::Descriptors::calcTPSA(mol);
   auto rotb = RDKit::Descriptors::calcNumRotatableBonds(mol, true);
-  auto withoutAliphaticRings = RDKit::deleteSubstructs(mol, *aliphaticRingMol);
-  auto arom = RDKit::MolOps::findSSSR(*withoutAliphaticRings);
+  auto arom = calcAromaticRings(mol, buffers);
 
   auto alerts = 0;
   for (auto &m : alertMols) {
@@ -64,19 +119,30 @@ QED::calcProperties(const RDKit::ROMol &mol,
     }
   }
 
-  return QEDproperties(amw, crippenLogP, hba, hbd, psa, rotb, arom, alerts);
+  return {float(amw),  float(crippenLogP), float(hba),  float(hbd),
+          float(psa),  float(rotb),        float(arom), float(alerts)};
+}
+
+float QED::CalcQED(const RDKit::ROMol &mol, Buffers &buffers) const {
+  auto amw = RDKit::Descriptors::calcAMW(mol);
+  double crippenLogP = 0;
+  double _mr = 0;
+  RDKit::Descriptors::calcCrippenDescriptors(mol, crippenLogP, _mr);
+  auto hbd = RDKit::Descriptors::calcNumHBD(mol);
+  auto psa = RDKit::Descriptors::calcTPSA(mol);
+  return CalcQED(mol, amw, crippenLogP, hbd, psa, buffers);
 }
 
-float QED::CalcQED(const RDKit::ROMol &mol) {
-  auto properties = calcProperties(mol, acceptorMols,
-                                   std::move(aliphaticRingsMol), alertMols);
+float QED::CalcQED(const RDKit::ROMol &mol, double amw, double crippenLogP,
+                   unsigned int hbd, double psa, Buffers &buffers) const {
+  auto properties = calcProperties(mol, amw, crippenLogP, hbd, psa, buffers);
   float sumOfWeightedADSValues = 0.0;
   float sumOfWeights = 0.0;
 
-  for (const auto &[k, v] : properties.data) {
+  for (int k = 0; k < PROPERTY_COUNT; k++) {
     sumOfWeightedADSValues +=
-        (WEIGHT_MEAN.data[k] * std::log(calcADS(properties.data[k], k)));
-    sumOfWeights += WEIGHT_MEAN.data[k];
+        (WEIGHT_MEAN[k] * std::log(calcADS(properties[k], Property(k))));
+    sumOfWeights += WEIGHT_MEAN[k];
   }
 
   return std::exp(sumOfWeightedADSValues / sumOfWeights);
@@ -7,10 +7,13 @@
 #include "duckdb/function/replacement_scan.hpp"
 #include "duckdb/function/table_function.hpp"
 #include "duckdb/main/client_context.hpp"
+#include "duckdb/planner/operator/logical_get.hpp"
+#include "duckdb/planner/operator/logical_limit.hpp"
 #include "duckdb/parser/expression/constant_expression.hpp"
 #include "duckdb/parser/expression/function_expression.hpp"
 #include "duckdb/parser/tableref/table_function_ref.hpp"
 #include "sdf_scanner/sdf_scan.hpp"
+#include "sdf_scanner/sdf_writer.hpp"
 #include "types.hpp"
 
 namespace duckdb {
@@ -20,50 +23,16 @@ static void ReadSDFFunction(ClientContext &context, TableFunctionInput &data_p,
 
   auto &gstate = data_p.global_state->Cast<SDFGlobalTableFunctionState>().state;
   auto &lstate = data_p.local_state->Cast<SDFLocalTableFunctionState>().state;
-  auto bind_data = data_p.bind_data->Cast<SDFScanData>();
+  auto &bind_data = data_p.bind_data->Cast<SDFScanData>();
 
-  lstate.ExtractNextChunk(gstate, lstate, bind_data);
+  lstate.ExtractNextChunk(gstate, lstate, bind_data, output);
 
-  D_ASSERT(lstate.scan_count == lstate.rows.size());
-  //! set to the number of rows scanned
+  //! set to the number of rows that pass the pushed down filters
   //! If the cardinality is zero, it will signal to duckdb to not run the read
-  //! function anymore because the scan is done. This is not equal to the number
-  //! of rows returned, if perhaps during predicate pushdown, no rows match.
-  //! If we are not done scanning the file, we would need to keep scanning
-  //! to see if there are other records that match the predicate
+  //! function anymore because the scan is done. ExtractNextChunk keeps
+  //! reading records until some of them pass the filters, so it is only zero
+  //! at the end of the scan
   output.SetCardinality(lstate.scan_count);
-
-  //! If the molecule column is not requested, the mol_col_idx flag is set to -1
-  //! This will cause an access error when trying to slice into the vector.
-  //! Therefore, set the index to 0 to avoid the error. The mol_col will not be
-  //! used anyways in this case.
-  if (bind_data.mol_col_idx == -1) {
-    bind_data.mol_col_idx = 0;
-  }
-  //! The mol_col is a reference to the DataChunk vector
-  //! This vector is then converted to a FlatVector with the string_t type
-  //! so that we can add blobs to it, which may have invalid UTF8.
-  auto &mol_col = output.data[bind_data.mol_col_idx];
-  auto col_data = FlatVector::GetData<string_t>(mol_col);
-
-  //! For each record/row scanned, set the value of each
-  //! column in the output DataChunk
-  for (idx_t i = 0; i < lstate.rows.size(); i++) {
-    for (idx_t j = 0; j < bind_data.names.size(); j++) {
-      auto val = lstate.rows[i][j];
-      //! handle the molecule column differently because it's a BLOB with
-      //! potentially invalid UTF8
-      if (bind_data.mol_col_idx > -1 && j == bind_data.mol_col_idx) {
-        col_data[i] = StringVector::AddStringOrBlob(mol_col, string_t(val));
-      } else {
-        if (val == "") {
-          output.SetValue(j, i, Value(nullptr));
-        } else {
-          output.SetValue(j, i, Value(val));
-        }
-      }
-    }
-  }
 }
 
 unique_ptr<FunctionData> ReadSDFBind(ClientContext &context,
@@ -72,6 +41,43 @@ unique_ptr<FunctionData> ReadSDFBind(ClientContext &context,
                                      vector<string> &names) {
   auto bind_data = make_uniq<SDFScanData>();
   bind_data->Bind(context, input);
+
+  //! the name of the filename column, empty if there is none
+  string filename_column;
+  for (auto &kv : input.named_parameters) {
+    auto loption = StringUtil::Lower(kv.first);
+    if (loption == "filename") {
+      if (kv.second.IsNull()) {
+        throw BinderException("read_sdf parameter \"%s\" cannot be NULL.",
+                              loption);
+      }
+      if (kv.second.type().id() == LogicalTypeId::VARCHAR) {
+        filename_column = StringValue::Get(kv.second);
+      } else if (BooleanValue::Get(kv.second.DefaultCastAs(
+                     LogicalType::BOOLEAN))) {
+        filename_column = "filename";
+      }
+    } else if (loption == "union_by_name") {
+      if (kv.second.IsNull()) {
+        throw BinderException("read_sdf parameter \"%s\" cannot be NULL.",
+                              loption);
+      }
+      bind_data->union_by_name = BooleanValue::Get(kv.second);
+    } else if (loption == "sample_size") {
+      if (kv.second.IsNull()) {
+        throw BinderException("read_sdf parameter \"%s\" cannot be NULL.",
+                              loption);
+      }
+      bind_data->sample_size = BigIntValue::Get(kv.second);
+    } else if (loption == "all_varchar") {
+      if (kv.second.IsNull()) {
+        throw BinderException("read_sdf parameter \"%s\" cannot be NULL.",
+                              loption);
+      }
+      bind_data->all_varchar = BooleanValue::Get(kv.second);
+    }
+  }
+
   if (input.table_function.name == "read_sdf_auto") {
     SDFScan::AutoDetect(context, *bind_data, return_types, names);
   } else {
@@ -126,18 +132,12 @@ unique_ptr<FunctionData> ReadSDFBind(ClientContext &context,
         bind_data->names = names;
         bind_data->types = types;
       }
-
-      //! TODO: not implemented yet
-      // else if (loption == "convert_strings_to_integers") {
-      // bind_data->convert_strings_to_integers =
-      // BooleanValue::Get(kv.second);
-      // }
     }
   }
 
-  if (bind_data->files.size() > 1) {
-    throw NotImplementedException(
-        "Reading more than one sdf file is currently not supported.");
+  if (!filename_column.empty()) {
+    SDFScan::AddFilenameColumn(filename_column, *bind_data, return_types,
+                               names);
   }
 
   return std::move(bind_data);
@@ -149,7 +149,9 @@ SDFFunctions::ReadSDFReplacement(ClientContext &context,
                                  optional_ptr<ReplacementScanData> data) {
   auto table_name = ReplacementScan::GetFullPath(input);
 
-  if (!ReplacementScan::CanReplace(table_name, {"sdf"})) {
+  //! compressed files are decompressed by the file system
+  if (!ReplacementScan::CanReplace(table_name,
+                                   {"sdf", "sdf.gz", "sdf.zst"})) {
     return nullptr;
   }
 
@@ -167,18 +169,27 @@ vector<TableFunctionSet> SDFFunctions::GetTableFunctions() {
 
   functions.push_back(GetReadSDFTableFunction());
   functions.push_back(GetReadSDFAutoTableFunction());
+  functions.push_back(GetSDFBuildIndexFunction());
 
   return functions;
 }
 
+CopyFunction SDFFunctions::GetCopyFunction() { return GetSDFCopyFunction(); }
+
 TableFunctionSet SDFFunctions::GetReadSDFTableFunction() {
   TableFunction table_function({LogicalType::VARCHAR}, ReadSDFFunction,
                                ReadSDFBind, SDFGlobalTableFunctionState::Init,
                                SDFLocalTableFunctionState::Init);
   table_function.name = "read_sdf";
   table_function.named_parameters["columns"] = LogicalType::ANY;
+  table_function.named_parameters["filename"] = LogicalType::ANY;
+  table_function.named_parameters["union_by_name"] = LogicalType::BOOLEAN;
   table_function.table_scan_progress = SDFScan::ScanProgress;
-  table_function.projection_pushdown = false;
+  table_function.get_partition_data = SDFScan::GetPartitionData;
+  table_function.cardinality = SDFScan::Cardinality;
+  table_function.projection_pushdown = true;
+  table_function.pushdown_complex_filter = SDFScan::PushdownComplexFilter;
+  table_function.get_virtual_columns = SDFScan::GetVirtualColumns;
   return MultiFileReader::CreateFunctionSet(table_function);
 }
 
@@ -188,9 +199,65 @@ TableFunctionSet SDFFunctions::GetReadSDFAutoTableFunction() {
                                SDFLocalTableFunctionState::Init);
   table_function.name = "read_sdf_auto";
   table_function.named_parameters["columns"] = LogicalType::ANY;
+  table_function.named_parameters["filename"] = LogicalType::ANY;
+  table_function.named_parameters["union_by_name"] = LogicalType::BOOLEAN;
+  table_function.named_parameters["sample_size"] = LogicalType::BIGINT;
+  table_function.named_parameters["all_varchar"] = LogicalType::BOOLEAN;
   table_function.table_scan_progress = SDFScan::ScanProgress;
-  table_function.projection_pushdown = false;
+  table_function.get_partition_data = SDFScan::GetPartitionData;
+  table_function.cardinality = SDFScan::Cardinality;
+  table_function.projection_pushdown = true;
+  table_function.pushdown_complex_filter = SDFScan::PushdownComplexFilter;
+  table_function.get_virtual_columns = SDFScan::GetVirtualColumns;
   return MultiFileReader::CreateFunctionSet(table_function);
 }
 
+// An OFFSET directly above the scan of files that all have an index skips
+// the records in the scan, which starts at the first record after them
+// instead of parsing and discarding the skipped records
+static void PushdownSDFOffset(unique_ptr<LogicalOperator> &plan) {
+  if (plan->type == LogicalOperatorType::LOGICAL_LIMIT) {
+    auto &limit = plan->Cast<LogicalLimit>();
+    auto child = plan->children[0].get();
+    while (child->type == LogicalOperatorType::LOGICAL_PROJECTION) {
+      child = child->children[0].get();
+    }
+    //! a percentage or expression LIMIT is computed over all the rows,
+    //! including the ones the OFFSET skips
+    auto limit_type = limit.limit_val.Type();
+    bool plain_limit = limit_type == LimitNodeType::UNSET ||
+                       limit_type == LimitNodeType::CONSTANT_VALUE;
+    if (plain_limit &&
+        limit.offset_val.Type() == LimitNodeType::CONSTANT_VALUE &&
+        child->type == LogicalOperatorType::LOGICAL_GET) {
+      auto &get = child->Cast<LogicalGet>();
+      if ((get.function.name == "read_sdf" ||
+           get.function.name == "read_sdf_auto") &&
+          get.bind_data) {
+        auto &bind_data = get.bind_data->Cast<SDFScanData>();
+        if (bind_data.AllFilesIndexed()) {
+          bind_data.skip_records += limit.offset_val.GetConstantValue();
+          limit.offset_val = BoundLimitNode();
+        }
+      }
+    }
+  }
+  for (auto &child : plan->children) {
+    PushdownSDFOffset(child);
+  }
+}
+
+// This runs before the built in optimizers, so that no filter has been
+// pushed into the scan yet. A filter cannot be pushed below the LIMIT later
+static void SDFPreOptimize(OptimizerExtensionInput &input,
+                           unique_ptr<LogicalOperator> &plan) {
+  PushdownSDFOffset(plan);
+}
+
+OptimizerExtension SDFFunctions::GetOptimizerExtension() {
+  OptimizerExtension optimizer;
+  optimizer.pre_optimize_function = SDFPreOptimize;
+  return optimizer;
+}
+
 } // namespace duckdb
@@ -0,0 +1,146 @@
+#include "sdf_scanner/sdf_index.hpp"
+#include "duckdb/common/multi_file/multi_file_reader.hpp"
+#include "duckdb/common/vector_size.hpp"
+#include "sdf_scanner/sdf_reader.hpp"
+#include "sdf_scanner/sdf_scan.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace duckdb {
+
+//! The header of an index file: magic, size of the SDF, last modified time
+//! of the SDF, number of records
+static constexpr char INDEX_MAGIC[8] = {'S', 'D', 'F', 'I',
+                                        'D', 'X', '0', '1'};
+static constexpr idx_t INDEX_HEADER_SIZE = 4 * sizeof(uint64_t);
+
+idx_t SDFIndex::FindRecordStart(idx_t pos, idx_t file_size) const {
+  auto entry =
+      std::lower_bound(record_offsets.begin(), record_offsets.end(), pos);
+  return entry == record_offsets.end() ? file_size : *entry;
+}
+
+unique_ptr<SDFIndex> SDFIndex::Load(ClientContext &context,
+                                    const string &path) {
+  auto &fs = FileSystem::GetFileSystem(context);
+  auto index_path = path + FILE_EXTENSION;
+  if (!fs.FileExists(index_path)) {
+    return nullptr;
+  }
+  auto file = SDFScan::OpenFile(context, path);
+  //! the records of a compressed file cannot be read from their offsets
+  if (!file->CanSeek()) {
+    return nullptr;
+  }
+  auto index_file = fs.OpenFile(index_path, FileFlags::FILE_FLAGS_READ);
+  auto index_size = index_file->GetFileSize();
+  if (index_size < INDEX_HEADER_SIZE) {
+    return nullptr;
+  }
+  uint64_t header[4];
+  index_file->Read(header, INDEX_HEADER_SIZE, 0);
+  if (memcmp(&header[0], INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+      header[1] != file->GetFileSize() ||
+      int64_t(header[2]) != fs.GetLastModifiedTime(*file).value ||
+      index_size != INDEX_HEADER_SIZE + header[3] * sizeof(uint64_t)) {
+    //! not an index, or the file changed since the index was built
+    return nullptr;
+  }
+  auto result = make_uniq<SDFIndex>();
+  result->record_offsets.resize(header[3]);
+  index_file->Read(result->record_offsets.data(),
+                   header[3] * sizeof(uint64_t), INDEX_HEADER_SIZE);
+  return result;
+}
+
+idx_t SDFIndex::Build(ClientContext &context, const string &path) {
+  auto &fs = FileSystem::GetFileSystem(context);
+  auto file = SDFScan::OpenFile(context, path);
+  if (!file->CanSeek()) {
+    throw InvalidInputException(
+        "sdf_build_index cannot index \"%s\": a compressed file can only be "
+        "read from its start",
+        path);
+  }
+  auto file_size = file->GetFileSize();
+
+  vector<idx_t> record_offsets;
+  SDFRecordReader reader;
+  reader.Reset(*file, 0, file_size);
+  while (reader.ReadRecords(STANDARD_VECTOR_SIZE) > 0) {
+    for (auto &record : reader.GetRecords()) {
+      record_offsets.push_back(reader.GetFileOffset(record));
+    }
+  }
+
+  uint64_t header[4];
+  memcpy(&header[0], INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  header[1] = file_size;
+  header[2] = uint64_t(fs.GetLastModifiedTime(*file).value);
+  header[3] = record_offsets.size();
+  auto index_file = fs.OpenFile(path + FILE_EXTENSION,
+                                FileFlags::FILE_FLAGS_WRITE |
+                                    FileFlags::FILE_FLAGS_FILE_CREATE_NEW);
+  index_file->Write(header, INDEX_HEADER_SIZE);
+  index_file->Write(record_offsets.data(),
+                    record_offsets.size() * sizeof(uint64_t));
+  index_file->Sync();
+  index_file->Close();
+  return record_offsets.size();
+}
+
+//===--------------------------------------------------------------------===//
+// sdf_build_index(path)
+//===--------------------------------------------------------------------===//
+struct SDFBuildIndexData : public TableFunctionData {
+  vector<OpenFileInfo> files;
+};
+
+struct SDFBuildIndexState : public GlobalTableFunctionState {
+  idx_t next_file = 0;
+};
+
+static unique_ptr<FunctionData>
+SDFBuildIndexBind(ClientContext &context, TableFunctionBindInput &input,
+                  vector<LogicalType> &return_types, vector<string> &names) {
+  auto result = make_uniq<SDFBuildIndexData>();
+  auto multi_file_reader = MultiFileReader::Create(input.table_function);
+  result->files = multi_file_reader->CreateFileList(context, input.inputs[0])
+                      ->GetAllFiles();
+  names.emplace_back("file");
+  return_types.emplace_back(LogicalType::VARCHAR);
+  names.emplace_back("records");
+  return_types.emplace_back(LogicalType::BIGINT);
+  return std::move(result);
+}
+
+static unique_ptr<GlobalTableFunctionState>
+SDFBuildIndexInit(ClientContext &context, TableFunctionInitInput &input) {
+  return make_uniq<SDFBuildIndexState>();
+}
+
+static void SDFBuildIndexFunction(ClientContext &context,
+                                  TableFunctionInput &data_p,
+                                  DataChunk &output) {
+  auto &bind_data = data_p.bind_data->Cast<SDFBuildIndexData>();
+  auto &state = data_p.global_state->Cast<SDFBuildIndexState>();
+  idx_t count = 0;
+  while (state.next_file < bind_data.files.size() &&
+         count < STANDARD_VECTOR_SIZE) {
+    auto &path = bind_data.files[state.next_file++].path;
+    auto record_count = SDFIndex::Build(context, path);
+    output.SetValue(0, count, Value(path));
+    output.SetValue(1, count, Value::BIGINT(int64_t(record_count)));
+    count++;
+  }
+  output.SetCardinality(count);
+}
+
+TableFunctionSet GetSDFBuildIndexFunction() {
+  TableFunction table_function("sdf_build_index", {LogicalType::VARCHAR},
+                               SDFBuildIndexFunction, SDFBuildIndexBind,
+                               SDFBuildIndexInit);
+  return MultiFileReader::CreateFunctionSet(table_function);
+}
+
+} // namespace duckdb
@@ -0,0 +1,213 @@
+#include "sdf_scanner/sdf_reader.hpp"
+#include "duckdb/common/helper.hpp"
+
+namespace duckdb {
+
+void SDFRecordReader::Reset(FileHandle &handle_p, idx_t start, idx_t end) {
+  handle = &handle_p;
+  file_pos = start;
+  range_end = end;
+  buffer.clear();
+  buffer_offset = start;
+  buffer_pos = 0;
+  records.clear();
+  properties.clear();
+}
+
+bool SDFRecordReader::ReadBlock() {
+  if (file_pos >= range_end) {
+    return false;
+  }
+  auto read_size = MinValue(BLOCK_SIZE, range_end - file_pos);
+  auto old_size = buffer.size();
+  buffer.resize(old_size + read_size);
+  if (!handle->CanSeek()) {
+    //! compressed files are decompressed as a stream, and read as a single
+    //! range up to their end
+    auto bytes_read =
+        handle->Read((void *)(buffer.data() + old_size), read_size);
+    if (bytes_read <= 0) {
+      buffer.resize(old_size);
+      range_end = file_pos;
+      return false;
+    }
+    buffer.resize(old_size + idx_t(bytes_read));
+    file_pos += idx_t(bytes_read);
+    return true;
+  }
+  handle->Read((void *)(buffer.data() + old_size), read_size, file_pos);
+  file_pos += read_size;
+  return true;
+}
+
+idx_t SDFRecordReader::ReadRecords(idx_t max_records) {
+  records.clear();
+  properties.clear();
+  //! the records of the previous call are not used anymore
+  if (buffer_pos > 0) {
+    buffer_offset += buffer_pos;
+    buffer.erase(0, buffer_pos);
+    buffer_pos = 0;
+  }
+  while (records.size() < max_records) {
+    idx_t record_end;
+    idx_t next_record;
+    if (!FindRecordEnd(record_end, next_record)) {
+      break;
+    }
+    ParseRecord(buffer_pos, record_end);
+    buffer_pos = next_record;
+  }
+  return records.size();
+}
+
+bool SDFRecordReader::FindRecordEnd(idx_t &record_end, idx_t &next_record) {
+  //! A record ends with a line that starts with $$$$, the same check that
+  //! the RDKit SDMolSupplier does
+  idx_t line = buffer_pos;
+  while (true) {
+    while (line < buffer.size()) {
+      auto newline = (const char *)memchr(buffer.data() + line, '\n',
+                                          buffer.size() - line);
+      if (!newline) {
+        break;
+      }
+      idx_t next_line = newline - buffer.data() + 1;
+      if (buffer.compare(line, 4, "$$$$") == 0) {
+        record_end = line;
+        next_record = next_line;
+        return true;
+      }
+      line = next_line;
+    }
+    //! the last line in the buffer is not complete
+    if (!ReadBlock()) {
+      break;
+    }
+  }
+
+  //! the range ends without a line break after its last line
+  if (buffer.find_first_not_of(" \t\r\n", buffer_pos) == string::npos) {
+    //! only blank lines after the last record
+    buffer_pos = buffer.size();
+    return false;
+  }
+  if (buffer.compare(line, 4, "$$$$") == 0) {
+    record_end = line;
+  } else {
+    record_end = buffer.size();
+  }
+  next_record = buffer.size();
+  return true;
+}
+
+idx_t SDFRecordReader::LineEnd(idx_t pos, idx_t end, idx_t &next_line) const {
+  auto newline = (const char *)memchr(buffer.data() + pos, '\n', end - pos);
+  idx_t line_end = end;
+  next_line = end;
+  if (newline) {
+    line_end = newline - buffer.data();
+    next_line = line_end + 1;
+  }
+  if (line_end > pos && buffer[line_end - 1] == '\r') {
+    line_end--;
+  }
+  return line_end;
+}
+
+void SDFRecordReader::ParseRecord(idx_t start, idx_t end) {
+  SDFRecord record;
+  //! without M  END, the whole record is given to the molblock parser
+  record.molblock = {start, end - start};
+  record.properties_begin = properties.size();
+
+  bool in_data_items = false;
+  idx_t pos = start;
+  while (pos < end) {
+    idx_t next_line;
+    auto line_end = LineEnd(pos, end, next_line);
+    if (!in_data_items) {
+      if (buffer.compare(pos, 6, "M  END") == 0) {
+        in_data_items = true;
+        record.molblock.size = next_line - start;
+      }
+      pos = next_line;
+      continue;
+    }
+    if (line_end == pos || buffer[pos] != '>') {
+      pos = next_line;
+      continue;
+    }
+
+    //! the name is between the first < and the last > of the line
+    auto name_start = (const char *)memchr(buffer.data() + pos, '<',
+                                           line_end - pos);
+    idx_t name_end = line_end;
+    while (name_end > pos && buffer[name_end - 1] != '>') {
+      name_end--;
+    }
+    pos = next_line;
+    if (!name_start) {
+      continue;
+    }
+    idx_t name_offset = name_start - buffer.data() + 1;
+    if (name_end <= name_offset + 1) {
+      continue;
+    }
+    SDFSlice name = {name_offset, name_end - 1 - name_offset};
+
+    //! the value is the lines up to the next blank line
+    idx_t value_start = pos;
+    idx_t value_end = pos;
+    bool has_carriage_return = false;
+    while (pos < end) {
+      auto value_line_end = LineEnd(pos, end, next_line);
+      idx_t first_char = pos;
+      while (first_char < value_line_end &&
+             (buffer[first_char] == ' ' || buffer[first_char] == '\t')) {
+        first_char++;
+      }
+      if (first_char == value_line_end) {
+        pos = next_line;
+        break;
+      }
+      if (value_end > value_start && buffer[value_end] == '\r') {
+        has_carriage_return = true;
+      }
+      value_end = value_line_end;
+      pos = next_line;
+    }
+
+    if (has_carriage_return) {
+      //! the lines of the value are joined with \n, so drop the \r of the
+      //! \r\n line breaks in place
+      idx_t out = value_start;
+      for (idx_t i = value_start; i < value_end; i++) {
+        if (buffer[i] == '\r' && i + 1 < value_end && buffer[i + 1] == '\n') {
+          continue;
+        }
+        buffer[out++] = buffer[i];
+      }
+      value_end = out;
+    }
+    properties.push_back({name, {value_start, value_end - value_start}});
+  }
+  record.properties_end = properties.size();
+  records.push_back(record);
+}
+
+bool SDFRecordReader::FindProperty(const SDFRecord &record, const string &name,
+                                   SDFSlice &value) const {
+  bool found = false;
+  for (idx_t i = record.properties_begin; i < record.properties_end; i++) {
+    auto &property = properties[i];
+    if (property.name.size == name.size() &&
+        memcmp(GetData(property.name), name.data(), name.size()) == 0) {
+      value = property.value;
+      found = true;
+    }
+  }
+  return found;
+}
+
+} // namespace duckdb
@@ -1,14 +1,29 @@
 #include "sdf_scanner/sdf_scan.hpp"
+#include "GraphMol/FileParsers/FileParsers.h"
 #include "duckdb/common/allocator.hpp"
+#include "duckdb/common/exception.hpp"
 #include "duckdb/common/helper.hpp"
+#include "duckdb/common/limits.hpp"
 #include "duckdb/common/multi_file/multi_file_reader.hpp"
+#include "duckdb/common/operator/cast_operators.hpp"
+#include "duckdb/common/string_util.hpp"
 #include "duckdb/common/types.hpp"
 #include "duckdb/common/unique_ptr.hpp"
+#include "duckdb/common/unordered_map.hpp"
+#include "duckdb/common/vector_operations/vector_operations.hpp"
 #include "duckdb/common/vector_size.hpp"
 #include "duckdb/function/table_function.hpp"
 #include "duckdb/main/client_context.hpp"
+#include "duckdb/planner/expression/bound_columnref_expression.hpp"
+#include "duckdb/planner/expression/bound_conjunction_expression.hpp"
+#include "duckdb/planner/expression/bound_reference_expression.hpp"
+#include "duckdb/planner/expression_iterator.hpp"
+#include "duckdb/planner/operator/logical_get.hpp"
+#include "mol_errors.hpp"
+#include "mol_formats.hpp"
 #include "types.hpp"
 #include "umbra_mol.hpp"
+#include <algorithm>
 #include <memory>
 
 namespace duckdb {
@@ -19,6 +34,9 @@ void SDFScanData::Bind(ClientContext &context, TableFunctionBindInput &input) {
   auto file_list = multi_file_reader->CreateFileList(context, input.inputs[0]);
 
   files = file_list->GetAllFiles();
+  for (auto &file : files) {
+    indexes.push_back(SDFIndex::Load(context, file.path));
+  }
 }
 
 unique_ptr<LocalTableFunctionState>
@@ -37,31 +55,208 @@ SDFGlobalTableFunctionState::Init(ClientContext &context,
   auto &bind_data = input.bind_data->Cast<SDFScanData>();
   auto result = make_uniq<SDFGlobalTableFunctionState>(context, input);
   auto &gstate = result->state;
+  gstate.column_ids = input.column_ids;
+  gstate.read_mol = false;
+  for (auto column_id : gstate.column_ids) {
+    if (bind_data.IsMolColumn(column_id)) {
+      gstate.read_mol = true;
+    }
+  }
 
   return std::move(result);
 }
 
 SDFScanGlobalState::SDFScanGlobalState(ClientContext &context_p,
                                        const SDFScanData &bind_data_p)
-    : bind_data(bind_data_p) {
-  //! open the sd file
-  mol_supplier =
-      make_uniq<RDKit::v2::FileParsers::SDMolSupplier>(bind_data.files[0].path);
-  length = mol_supplier->length();
-  offset = 0;
+    : bind_data(bind_data_p), range_count(0), total_size(0), next_range(0),
+      bytes_scanned(0) {
+  //! the skipped records are only set when all files have an index
+  auto skip_records = bind_data.skip_records;
+  for (idx_t i = 0; i < bind_data.files.size(); i++) {
+    auto handle = SDFScan::OpenFile(context_p, bind_data.files[i].path);
+    auto file_size = handle->GetFileSize();
+    idx_t file_start = 0;
+    bool file_skipped = false;
+    if (skip_records > 0) {
+      auto &record_offsets = bind_data.indexes[i]->record_offsets;
+      auto skipped = MinValue<idx_t>(skip_records, record_offsets.size());
+      file_skipped = skipped == record_offsets.size();
+      file_start = file_skipped ? file_size : record_offsets[skipped];
+      skip_records -= skipped;
+    }
+    file_sizes.push_back(file_size);
+    file_seekable.push_back(handle->CanSeek());
+    file_starts.push_back(file_start);
+    file_first_range.push_back(range_count);
+    if (file_skipped) {
+      //! all records of the file are skipped, so it has no ranges
+    } else if (handle->CanSeek()) {
+      range_count += MaxValue<idx_t>(
+          1, (file_size - file_start + RANGE_SIZE - 1) / RANGE_SIZE);
+    } else {
+      //! a compressed file is decompressed as one stream
+      range_count++;
+    }
+    total_size += file_size - file_start;
+  }
 }
 
 SDFScanLocalState::SDFScanLocalState(ClientContext &context_p,
                                      SDFScanGlobalState &gstate_p)
-    : scan_count(0), bind_data(gstate_p.bind_data) {}
+    : context(context_p), scan_count(0), range_idx(0), file_idx(0),
+      property_text(LogicalType::VARCHAR),
+      error_state(MolErrorState::Get(context_p)),
+      bind_data(gstate_p.bind_data) {
+  if (bind_data.filter) {
+    filter_executor = make_uniq<ExpressionExecutor>(context, *bind_data.filter);
+    auto &allocator = Allocator::Get(context);
+    filter_text.Initialize(
+        allocator, vector<LogicalType>(bind_data.filter_types.size(),
+                                       LogicalType::VARCHAR));
+    filter_chunk.Initialize(allocator, bind_data.filter_types);
+    filter_sel.Initialize(STANDARD_VECTOR_SIZE);
+  }
+}
+
+idx_t SDFScanLocalState::FindRecordStart(FileHandle &handle, idx_t pos,
+                                         idx_t file_size) {
+  if (pos == 0 || pos >= file_size) {
+    return MinValue(pos, file_size);
+  }
+  static constexpr idx_t BLOCK_SIZE = 4096;
+  char block[BLOCK_SIZE];
+
+  //! The line before pos can be a $$$$ delimiter, or pos can be in the middle
+  //! of one. Go back to the start of the line that contains pos - 1, so that
+  //! the lines are recognized from their first character
+  idx_t line_start = pos - 1;
+  bool found_line_start = false;
+  while (line_start > 0 && !found_line_start) {
+    auto read_start = line_start > BLOCK_SIZE ? line_start - BLOCK_SIZE : 0;
+    auto read_size = line_start - read_start;
+    handle.Read(block, read_size, read_start);
+    for (idx_t i = read_size; i > 0; i--) {
+      if (block[i - 1] == '\n') {
+        line_start = read_start + i;
+        found_line_start = true;
+        break;
+      }
+    }
+    if (!found_line_start) {
+      line_start = read_start;
+    }
+  }
+
+  //! A record starts after a line that starts with $$$$, the same check that
+  //! the RDKit SDMolSupplier does
+  idx_t column = 0;
+  idx_t dollars = 0;
+  for (idx_t block_start = line_start; block_start < file_size;
+       block_start += BLOCK_SIZE) {
+    auto read_size = MinValue(BLOCK_SIZE, file_size - block_start);
+    handle.Read(block, read_size, block_start);
+    for (idx_t i = 0; i < read_size; i++) {
+      if (block[i] == '\n') {
+        auto next_line = block_start + i + 1;
+        if (dollars == 4 && next_line >= pos) {
+          return next_line;
+        }
+        column = 0;
+        dollars = 0;
+        continue;
+      }
+      if (column == dollars && dollars < 4 && block[i] == '$') {
+        dollars++;
+      }
+      column++;
+    }
+  }
+  return file_size;
+}
+
+bool SDFScanLocalState::NextRange(SDFScanGlobalState &gstate) {
+  if (has_range) {
+    gstate.bytes_scanned += range_size;
+    has_range = false;
+  }
+  while (true) {
+    auto range = gstate.next_range++;
+    if (range >= gstate.range_count) {
+      return false;
+    }
+    //! every thread has its own handle, and reads its ranges from it
+    auto &first_ranges = gstate.file_first_range;
+    auto range_file =
+        std::upper_bound(first_ranges.begin(), first_ranges.end(), range) -
+        first_ranges.begin() - 1;
+    if (!file_handle || range_file != file_idx) {
+      file_idx = range_file;
+      file_handle = SDFScan::OpenFile(context, bind_data.files[file_idx].path);
+    }
+    auto file_size = gstate.file_sizes[file_idx];
+    auto &index = bind_data.indexes[file_idx];
+    if (!gstate.file_seekable[file_idx]) {
+      //! the whole file is a single range, read from the start of the stream
+      range_size = file_size;
+      range_idx = range;
+      reader.Reset(*file_handle, 0, NumericLimits<idx_t>::Maximum());
+      has_range = true;
+      return true;
+    }
+    auto range_start = gstate.file_starts[file_idx] +
+                       (range - first_ranges[file_idx]) *
+                           SDFScanGlobalState::RANGE_SIZE;
+    range_size = MinValue(SDFScanGlobalState::RANGE_SIZE,
+                          file_size - MinValue(range_start, file_size));
+    //! with an index, the record boundaries are looked up instead of read
+    auto range_end = range_start + range_size;
+    auto start = index ? index->FindRecordStart(range_start, file_size)
+                       : FindRecordStart(*file_handle, range_start, file_size);
+    auto end = index ? index->FindRecordStart(range_end, file_size)
+                     : FindRecordStart(*file_handle, range_end, file_size);
+    if (start >= end) {
+      //! a record that is longer than a range can cover the whole range
+      gstate.bytes_scanned += range_size;
+      continue;
+    }
+
+    range_idx = range;
+    reader.Reset(*file_handle, start, end);
+    has_range = true;
+    return true;
+  }
+}
 
 SDFGlobalTableFunctionState::SDFGlobalTableFunctionState(
     ClientContext &context, TableFunctionInitInput &input)
     : state(context, input.bind_data->Cast<SDFScanData>()) {}
 
+//! Parses the molblock of a record into a molecule. Returns nullptr if the
+//! molecule cannot be parsed, like the RDKit SDMolSupplier does, and sets
+//! error to the reason
+static std::unique_ptr<RDKit::RWMol>
+ParseMolBlock(const char *data, idx_t size, string &error) {
+  ReadOnlyMemoryBuf buf(data, size);
+  std::istream stream(&buf);
+  unsigned int line = 0;
+  try {
+    auto mol = RDKit::v2::FileParsers::MolFromMolDataStream(stream, line);
+    if (!mol) {
+      error = "Molblock Parse Error";
+    }
+    return mol;
+  } catch (std::exception &e) {
+    error = e.what();
+  } catch (...) {
+    error = "Molblock Parse Error";
+  }
+  return nullptr;
+}
+
 void SDFScanLocalState::ExtractNextChunk(SDFScanGlobalState &gstate,
                                          SDFScanLocalState &lstate,
-                                         SDFScanData &bind_data) {
+                                         const SDFScanData &bind_data,
+                                         DataChunk &output) {
 
   //! This holds the number of records scanned in this current
   //! function call.
@@ -69,90 +264,287 @@ void SDFScanLocalState::ExtractNextChunk(SDFScanGlobalState &gstate,
   //! If nothing gets scanned, the scan_count will be just zero
   //! and duckdb will be signalled that the scanning is complete
   lstate.scan_count = 0;
-  lstate.rows.clear();
 
-  while (lstate.scan_count < STANDARD_VECTOR_SIZE &&
-         !gstate.mol_supplier->atEnd()) {
-    auto remaining = gstate.length - lstate.scan_count;
-    if (remaining == 0) {
-      break;
+  auto &column_ids = gstate.column_ids;
+  idx_t record_count = 0;
+  //! the number of records that pass the filter
+  idx_t row_count = 0;
+  while (true) {
+    //! the records of a chunk all come from the same range, so that the
+    //! chunk has a single batch index
+    if (has_range) {
+      record_count = reader.ReadRecords(STANDARD_VECTOR_SIZE);
+      if (record_count > 0) {
+        row_count = filter_executor ? FilterRecords(record_count)
+                                    : record_count;
+        if (row_count > 0) {
+          break;
+        }
+        //! no record passes the filter, so read the next records instead
+        //! of returning an empty chunk, which would end the scan
+        continue;
+      }
+    }
+    if (!NextRange(gstate)) {
+      return;
     }
+  }
 
-    bool printed_warning = false;
-    vector<string> cur_row;
-    auto cur_mol = gstate.mol_supplier->next();
-    //! Go through each column specified and store the property in a vector
-    //! This represents one row in the "table".
-    for (idx_t i = 0; i < bind_data.names.size(); i++) {
-      //! NOTE: using the RDKit MolSupplier, if the record cannot be parsed,
-      //! it is because the molecule cannot be parsed. The other columns are
-      //! probably not null, but right now nothing of that record is
-      //! stored because that cannot be accessed with the way the MolSupplier
-      //! is implemented.
-      //!
-      //! TODO: write a parser to parse the non-molecule parts of the SDF.
-      //! This may enable filter pushdown and also allow the other fields
-      //! to be returned even if the molecule cannot be parsed
-      if (cur_mol) {
-        //! The column at the current iteration of i is the Mol type
-        //! In this case, we should convert the molecule object
-        //! to the "umbra" mol in duckdb_rdkit
-        if (bind_data.types[i] == Mol().ToString()) {
-          auto res = get_umbra_mol_string(*cur_mol);
-          cur_row.emplace_back(res);
+  //! The records that are returned
+  auto &sel = filter_executor ? filter_sel
+                              : *FlatVector::IncrementalSelectionVector();
+  auto &records = reader.GetRecords();
+  for (idx_t j = 0; j < column_ids.size(); j++) {
+    auto column_id = column_ids[j];
+    auto &col = output.data[j];
+    if (!bind_data.HasColumn(column_id)) {
+      //! the row id or the empty column of count(*), SDF records have neither
+      FlatVector::Validity(col).SetAllInvalid(row_count);
+      continue;
+    }
+    if (bind_data.IsMolColumn(column_id)) {
+      //! the molblocks are parsed only for the records that pass the filter.
+      //! The Mol is a BLOB, with potentially invalid UTF8
+      auto col_data = FlatVector::GetData<string_t>(col);
+      for (idx_t i = 0; i < row_count; i++) {
+        auto &molblock = records[sel.get_index(i)].molblock;
+        string error;
+        auto cur_mol =
+            ParseMolBlock(reader.GetData(molblock), molblock.size, error);
+        if (cur_mol) {
+          //! convert the molecule object to the "umbra" mol in duckdb_rdkit
+          auto umbra_mol = get_umbra_mol_string(*cur_mol);
+          col_data[i] = StringVector::AddStringOrBlob(
+              col, umbra_mol.data(), umbra_mol.size());
         } else {
-          //! Otherwise, it is a normal property column
-          std::string prop;
-          cur_mol->getPropIfPresent(bind_data.names[i], prop);
-          cur_row.emplace_back(prop);
+          //! reported by rdkit_last_errors(), with the position of the record
+          FlatVector::SetNull(col, i, true);
+          auto &record = records[sel.get_index(i)];
+          mol_errors.push_back(
+              {StringUtil::Format("%s at byte %llu",
+                                  bind_data.files[file_idx].path,
+                                  reader.GetFileOffset(record)),
+               std::move(error)});
         }
-      } else {
-        //! only print the warning once per record, not once per column
-        //! of the record
-        if (!printed_warning) {
-          std::cout << "Molecule could not be constructed at record #: "
-                    << gstate.offset << std::endl;
-          printed_warning = true;
+      }
+      continue;
+    }
+
+    //! The properties of a record are returned even if its molecule cannot
+    //! be parsed. The text points into the reader buffer, so VARCHAR values
+    //! are copied into the output vector, and other types are cast from the
+    //! text straight into it
+    ReadPropertyText(column_id, sel, row_count, property_text);
+    if (col.GetType().id() == LogicalTypeId::VARCHAR) {
+      auto text_data = FlatVector::GetData<string_t>(property_text);
+      auto &text_validity = FlatVector::Validity(property_text);
+      auto col_data = FlatVector::GetData<string_t>(col);
+      for (idx_t i = 0; i < row_count; i++) {
+        if (!text_validity.RowIsValid(i)) {
+          FlatVector::SetNull(col, i, true);
+          continue;
         }
-        cur_row.emplace_back("");
+        col_data[i] = StringVector::AddString(col, text_data[i]);
       }
+    } else {
+      CastPropertyText(column_id, property_text, col, row_count);
+    }
+  }
+  lstate.scan_count = row_count;
+  if (gstate.read_mol) {
+    error_state->AddErrors(mol_errors);
+  }
+}
+
+void SDFScanLocalState::ReadPropertyText(column_t column_id,
+                                         const SelectionVector &sel,
+                                         idx_t count, Vector &text) {
+  auto &records = reader.GetRecords();
+  auto text_data = FlatVector::GetData<string_t>(text);
+  auto &text_validity = FlatVector::Validity(text);
+  text_validity.SetAllValid(count);
+  if (bind_data.IsFilenameColumn(column_id)) {
+    auto &path = bind_data.files[file_idx].path;
+    for (idx_t i = 0; i < count; i++) {
+      text_data[i] = string_t(path.c_str(), path.size());
+    }
+    return;
+  }
+  auto &name = bind_data.names[column_id];
+  for (idx_t i = 0; i < count; i++) {
+    SDFSlice value;
+    if (reader.FindProperty(records[sel.get_index(i)], name, value) &&
+        value.size > 0) {
+      text_data[i] = string_t(reader.GetData(value), value.size);
+    } else {
+      //! missing and empty properties are NULL
+      text_validity.SetInvalid(i);
+    }
+  }
+}
+
+void SDFScanLocalState::CastPropertyText(column_t column_id, Vector &text,
+                                         Vector &result, idx_t count) {
+  string error;
+  if (VectorOperations::TryCast(context, text, result, count, &error)) {
+    return;
+  }
+  auto &name = bind_data.names[column_id];
+  if (bind_data.detected_types) {
+    //! the type was detected from a sample that did not have this value
+    throw ConversionException(
+        "read_sdf_auto could not convert property \"%s\" to %s: %s. The "
+        "types of the properties are detected from a sample of the records. "
+        "Set all_varchar=true, or a larger sample_size (-1 samples all "
+        "records)",
+        name, result.GetType().ToString(), error);
+  }
+  throw ConversionException("read_sdf could not convert property \"%s\" to "
+                            "%s: %s",
+                            name, result.GetType().ToString(), error);
+}
+
+idx_t SDFScanLocalState::FilterRecords(idx_t record_count) {
+  filter_chunk.Reset();
+  auto &all_records = *FlatVector::IncrementalSelectionVector();
+  for (idx_t c = 0; c < bind_data.filter_column_ids.size(); c++) {
+    auto &text = filter_text.data[c];
+    ReadPropertyText(bind_data.filter_column_ids[c], all_records, record_count,
+                     text);
+    //! the properties are cast the same way as when they are returned. The
+    //! VARCHAR columns point into the reader buffer, which is valid until
+    //! the next records are read
+    if (bind_data.filter_types[c].id() == LogicalTypeId::VARCHAR) {
+      filter_chunk.data[c].Reference(text);
+    } else {
+      CastPropertyText(bind_data.filter_column_ids[c], text,
+                       filter_chunk.data[c], record_count);
     }
-    lstate.rows.emplace_back(cur_row);
-    lstate.scan_count++;
-    gstate.offset++;
   }
+  filter_text.SetCardinality(record_count);
+  filter_chunk.SetCardinality(record_count);
+  return filter_executor->SelectExpression(filter_chunk, filter_sel);
 }
 
+//! The types a property can have given the values sampled so far. The most
+//! specific type that all values can be cast to is used
+struct SDFPropertyType {
+  bool has_values = false;
+  bool can_be_boolean = true;
+  bool can_be_bigint = true;
+  bool can_be_double = true;
+
+  void Update(const char *data, idx_t size) {
+    if (size == 0) {
+      //! empty values are NULL
+      return;
+    }
+    has_values = true;
+    string_t value(data, size);
+    if (can_be_boolean) {
+      can_be_boolean = StringUtil::CIEquals(value.GetString(), "true") ||
+                       StringUtil::CIEquals(value.GetString(), "false");
+    }
+    if (can_be_bigint) {
+      int64_t result;
+      can_be_bigint = TryCast::Operation(value, result, true);
+    }
+    if (can_be_double) {
+      double result;
+      can_be_double = TryCast::Operation(value, result, true);
+    }
+  }
+
+  LogicalType GetType() const {
+    if (!has_values) {
+      return LogicalType::VARCHAR;
+    }
+    if (can_be_boolean) {
+      return LogicalType::BOOLEAN;
+    }
+    if (can_be_bigint) {
+      return LogicalType::BIGINT;
+    }
+    if (can_be_double) {
+      return LogicalType::DOUBLE;
+    }
+    return LogicalType::VARCHAR;
+  }
+};
+
 void SDFScan::AutoDetect(ClientContext &context, SDFScanData &bind_data,
                          vector<LogicalType> &return_types,
                          vector<string> &names) {
-  //! open the sd file to scan the first record
-  auto mol_supplier =
-      make_uniq<RDKit::v2::FileParsers::SDMolSupplier>(bind_data.files[0].path);
-  while (!mol_supplier->atEnd()) {
-
-    auto cur_mol = mol_supplier->next();
-    std::set<string> seen;
-    if (cur_mol) {
-      for (auto p : cur_mol->getPropList()) {
-        //! These are props seem to be added by RDKit...these are there
-        //! even if the SDF doesn't contain these properties
-        if (p != "__computedProps" && p != "_Name" && p != "_MolFileInfo" &&
-            p != "_MolFileComments" && p != "_MolFileChiralFlag" &&
-            p != "numArom" && p != "_StereochemDone") {
-          names.push_back(p);
-          bind_data.types.emplace_back(
-              LogicalTypeIdToString(LogicalTypeId::VARCHAR));
-          return_types.emplace_back(TransformStringToLogicalType(
-              StringValue::Get("VARCHAR"), context));
+  //! The sample is taken from several places in the file, so that properties
+  //! that only appear further into the file are found too
+  static constexpr idx_t SAMPLE_PARTS = 8;
+
+  SDFRecordReader reader;
+  unordered_map<string, idx_t> property_idx;
+  vector<SDFPropertyType> property_types;
+  auto sample_records = [&]() {
+    for (auto &record : reader.GetRecords()) {
+      for (idx_t i = record.properties_begin; i < record.properties_end; i++) {
+        auto &property = reader.GetProperty(i);
+        auto name = reader.GetString(property.name);
+        auto entry = property_idx.find(name);
+        if (entry == property_idx.end()) {
+          entry = property_idx.emplace(name, names.size()).first;
+          names.push_back(name);
+          property_types.emplace_back();
+        }
+        property_types[entry->second].Update(reader.GetData(property.value),
+                                             property.value.size);
+      }
+    }
+  };
+
+  for (auto &file : bind_data.files) {
+    auto handle = OpenFile(context, file.path);
+    auto file_size = handle->GetFileSize();
+    if (bind_data.sample_size < 0) {
+      //! a negative sample size reads the whole file
+      reader.Reset(*handle, 0,
+                   handle->CanSeek() ? file_size
+                                     : NumericLimits<idx_t>::Maximum());
+      while (reader.ReadRecords(STANDARD_VECTOR_SIZE) > 0) {
+        sample_records();
+      }
+    } else if (!handle->CanSeek()) {
+      //! a compressed file can only be sampled from its start
+      reader.Reset(*handle, 0, NumericLimits<idx_t>::Maximum());
+      reader.ReadRecords(idx_t(bind_data.sample_size));
+      sample_records();
+    } else {
+      auto sample_size = idx_t(bind_data.sample_size);
+      auto parts =
+          MinValue<idx_t>(SAMPLE_PARTS, MaxValue<idx_t>(1, sample_size));
+      auto part_size = (sample_size + parts - 1) / parts;
+      for (idx_t part = 0; part < parts; part++) {
+        auto start = SDFScanLocalState::FindRecordStart(
+            *handle, file_size / parts * part, file_size);
+        if (start >= file_size) {
+          break;
         }
+        reader.Reset(*handle, start, file_size);
+        reader.ReadRecords(part_size);
+        sample_records();
       }
+    }
+    if (!bind_data.union_by_name) {
       break;
     }
   }
-  mol_supplier->close();
 
-  //! The molecule block is not in the getPropList
+  bind_data.detected_types = !bind_data.all_varchar;
+  for (auto &property_type : property_types) {
+    auto type = bind_data.all_varchar ? LogicalType::VARCHAR
+                                      : property_type.GetType();
+    bind_data.types.push_back(type.ToString());
+    return_types.push_back(type);
+  }
+
+  //! The molecule is the last column
   names.push_back("mol");
   bind_data.types.push_back("Mol");
   bind_data.mol_col_idx = names.size() - 1;
@@ -160,6 +552,36 @@ void SDFScan::AutoDetect(ClientContext &context, SDFScanData &bind_data,
   bind_data.names = names;
 }
 
+void SDFScan::AddFilenameColumn(const string &column_name,
+                                SDFScanData &bind_data,
+                                vector<LogicalType> &return_types,
+                                vector<string> &names) {
+  for (auto &name : names) {
+    if (StringUtil::CIEquals(name, column_name)) {
+      throw BinderException(
+          "Option filename adds column \"%s\", but a column with this name "
+          "is also in the file. Try setting a different name: "
+          "filename='<filename column name>'",
+          column_name);
+    }
+  }
+  names.push_back(column_name);
+  bind_data.types.push_back(LogicalTypeIdToString(LogicalTypeId::VARCHAR));
+  bind_data.filename_col_idx = names.size() - 1;
+  return_types.emplace_back(LogicalType::VARCHAR);
+  bind_data.names = names;
+}
+
+virtual_column_map_t SDFScan::GetVirtualColumns(ClientContext &,
+                                                optional_ptr<FunctionData>) {
+  virtual_column_map_t result;
+  result.insert(make_pair(MultiFileReader::COLUMN_IDENTIFIER_FILENAME,
+                          TableColumn("filename", LogicalType::VARCHAR)));
+  result.insert(make_pair(COLUMN_IDENTIFIER_EMPTY,
+                          TableColumn("", LogicalType::BOOLEAN)));
+  return result;
+}
+
 SDFLocalTableFunctionState::SDFLocalTableFunctionState(
     ClientContext &context_p, SDFScanGlobalState &gstate_p)
     : state(context_p, gstate_p) {}
@@ -167,7 +589,117 @@ SDFLocalTableFunctionState::SDFLocalTableFunctionState(
 double SDFScan::ScanProgress(ClientContext &, const FunctionData *,
                              const GlobalTableFunctionState *global_state) {
   auto &gstate = global_state->Cast<SDFGlobalTableFunctionState>().state;
-  return 100.0 * (double)gstate.offset / (double)gstate.length;
+  if (gstate.total_size == 0) {
+    return 100.0;
+  }
+  return 100.0 * (double)gstate.bytes_scanned / (double)gstate.total_size;
+}
+
+unique_ptr<FileHandle> SDFScan::OpenFile(ClientContext &context,
+                                         const string &path) {
+  auto &fs = FileSystem::GetFileSystem(context);
+  return fs.OpenFile(path, FileFlags::FILE_FLAGS_READ |
+                               FileCompressionType::AUTO_DETECT);
+}
+
+unique_ptr<NodeStatistics>
+SDFScan::Cardinality(ClientContext &, const FunctionData *bind_data_p) {
+  auto &bind_data = bind_data_p->Cast<SDFScanData>();
+  if (!bind_data.AllFilesIndexed()) {
+    return nullptr;
+  }
+  idx_t record_count = 0;
+  for (auto &index : bind_data.indexes) {
+    record_count += index->RecordCount();
+  }
+  record_count -= MinValue(record_count, bind_data.skip_records);
+  return make_uniq<NodeStatistics>(record_count, record_count);
+}
+
+OperatorPartitionData
+SDFScan::GetPartitionData(ClientContext &context,
+                          TableFunctionGetPartitionInput &input) {
+  if (input.partition_info.RequiresPartitionColumns()) {
+    throw InternalException("read_sdf does not support partition columns");
+  }
+  auto &lstate = input.local_state->Cast<SDFLocalTableFunctionState>().state;
+  return OperatorPartitionData(lstate.range_idx);
+}
+
+//! Checks that the filter only uses property columns of this scan, and
+//! collects them. The Mol column and the row id are not read before the
+//! molblocks are parsed
+static bool IsPropertyFilter(const Expression &expr, const LogicalGet &get,
+                             const SDFScanData &bind_data,
+                             vector<column_t> &column_ids) {
+  if (expr.GetExpressionClass() == ExpressionClass::BOUND_COLUMN_REF) {
+    auto &colref = expr.Cast<BoundColumnRefExpression>();
+    if (colref.depth > 0 || colref.binding.table_index != get.table_index) {
+      return false;
+    }
+    auto column_id =
+        get.GetColumnIds()[colref.binding.column_index].GetPrimaryIndex();
+    if (!bind_data.HasColumn(column_id) || bind_data.IsMolColumn(column_id)) {
+      return false;
+    }
+    column_ids.push_back(column_id);
+    return true;
+  }
+  bool result = true;
+  ExpressionIterator::EnumerateChildren(expr, [&](const Expression &child) {
+    result = result && IsPropertyFilter(child, get, bind_data, column_ids);
+  });
+  return result;
+}
+
+//! Replaces the column references with references into the chunk of the
+//! filter columns
+static void BindFilterColumns(unique_ptr<Expression> &expr,
+                              const LogicalGet &get, SDFScanData &bind_data) {
+  if (expr->GetExpressionClass() == ExpressionClass::BOUND_COLUMN_REF) {
+    auto &colref = expr->Cast<BoundColumnRefExpression>();
+    auto column_id =
+        get.GetColumnIds()[colref.binding.column_index].GetPrimaryIndex();
+    auto &filter_columns = bind_data.filter_column_ids;
+    auto entry =
+        std::find(filter_columns.begin(), filter_columns.end(), column_id);
+    idx_t index = entry - filter_columns.begin();
+    if (entry == filter_columns.end()) {
+      filter_columns.push_back(column_id);
+      bind_data.filter_types.push_back(colref.return_type);
+    }
+    expr = make_uniq<BoundReferenceExpression>(colref.return_type, index);
+    return;
+  }
+  ExpressionIterator::EnumerateChildren(
+      *expr, [&](unique_ptr<Expression> &child) {
+        BindFilterColumns(child, get, bind_data);
+      });
+}
+
+void SDFScan::PushdownComplexFilter(ClientContext &, LogicalGet &get,
+                                    FunctionData *bind_data_p,
+                                    vector<unique_ptr<Expression>> &filters) {
+  auto &bind_data = bind_data_p->Cast<SDFScanData>();
+  for (idx_t i = 0; i < filters.size(); i++) {
+    auto &filter = filters[i];
+    vector<column_t> filter_columns;
+    if (filter->IsVolatile() || filter->HasSubquery() ||
+        !IsPropertyFilter(*filter, get, bind_data, filter_columns) ||
+        filter_columns.empty()) {
+      continue;
+    }
+    BindFilterColumns(filter, get, bind_data);
+    if (bind_data.filter) {
+      bind_data.filter = make_uniq<BoundConjunctionExpression>(
+          ExpressionType::CONJUNCTION_AND, std::move(bind_data.filter),
+          std::move(filter));
+    } else {
+      bind_data.filter = std::move(filter);
+    }
+    filters.erase_at(i);
+    i--;
+  }
 }
 
 } // namespace duckdb
@@ -0,0 +1,269 @@
+#include "sdf_scanner/sdf_writer.hpp"
+#include "GraphMol/FileParsers/FileParsers.h"
+#include "duckdb/common/exception.hpp"
+#include "duckdb/common/file_system.hpp"
+#include "duckdb/common/mutex.hpp"
+#include "duckdb/common/types/column/column_data_collection.hpp"
+#include "duckdb/common/vector_operations/vector_operations.hpp"
+#include "duckdb/main/client_context.hpp"
+#include "mol_formats.hpp"
+#include "types.hpp"
+#include "umbra_mol.hpp"
+
+namespace duckdb {
+
+struct SDFWriteBindData : public TableFunctionData {
+  vector<string> names;
+  //! The column of the molecules, written as the molblocks
+  idx_t mol_col_idx = 0;
+};
+
+struct SDFWriteGlobalState : public GlobalFunctionData {
+  void WriteData(const string &data) {
+    lock_guard<mutex> guard(lock);
+    handle->Write((void *)data.data(), data.size());
+  }
+
+  mutex lock;
+  unique_ptr<FileHandle> handle;
+};
+
+struct SDFWriteLocalState : public LocalFunctionData {
+  //! The records of this thread that are not written to the file yet
+  string buffer;
+};
+
+struct SDFWriteBatchData : public PreparedBatchData {
+  //! The records of a batch, in order
+  string data;
+};
+
+//! The size of the buffer of a thread before it is written to the file, when
+//! the order of the rows does not matter
+static constexpr idx_t SDF_WRITE_FLUSH_SIZE = 1024 * 1024;
+
+static unique_ptr<FunctionData>
+SDFWriteBind(ClientContext &context, CopyFunctionBindInput &input,
+             const vector<string> &names,
+             const vector<LogicalType> &sql_types) {
+  if (!input.info.options.empty()) {
+    throw BinderException("Unrecognized option for COPY ... (FORMAT sdf): %s",
+                          input.info.options.begin()->first);
+  }
+  auto result = make_uniq<SDFWriteBindData>();
+  result->names = names;
+  bool has_mol = false;
+  for (idx_t i = 0; i < sql_types.size(); i++) {
+    if (!has_mol && sql_types[i] == Mol()) {
+      result->mol_col_idx = i;
+      has_mol = true;
+      continue;
+    }
+    //! the other columns are written as > <name> header lines, which only
+    //! read back if the name is on one line and is not cut by < or >
+    if (names[i].empty() ||
+        names[i].find_first_of("<>\r\n") != string::npos) {
+      throw BinderException(
+          "COPY ... (FORMAT sdf) cannot write column \"%s\": the names of "
+          "the properties cannot be empty or contain <, > or line breaks. "
+          "Rename the column with AS",
+          names[i]);
+    }
+  }
+  if (has_mol) {
+    return std::move(result);
+  }
+  throw BinderException(
+      "COPY ... (FORMAT sdf) needs a Mol column to write the molblocks of the "
+      "records");
+}
+
+static unique_ptr<GlobalFunctionData>
+SDFWriteInitializeGlobal(ClientContext &context, FunctionData &,
+                         const string &file_path) {
+  auto &fs = FileSystem::GetFileSystem(context);
+  auto result = make_uniq<SDFWriteGlobalState>();
+  //! .sdf.gz files are compressed by the file system
+  auto flags = FileFlags::FILE_FLAGS_WRITE |
+               FileFlags::FILE_FLAGS_FILE_CREATE_NEW |
+               FileLockType::WRITE_LOCK | FileCompressionType::AUTO_DETECT;
+  result->handle = fs.OpenFile(file_path, flags);
+  return std::move(result);
+}
+
+static unique_ptr<LocalFunctionData>
+SDFWriteInitializeLocal(ExecutionContext &, FunctionData &) {
+  return make_uniq<SDFWriteLocalState>();
+}
+
+//! Throws if the value would not be read back as the value of the property:
+//! a blank line ends the value early, and a line that starts with $$$$ ends
+//! the record. An empty value is written as a single blank line, which is
+//! read back as empty
+static void CheckPropertyValue(const string &name, string_t value) {
+  auto data = value.GetData();
+  auto size = value.GetSize();
+  if (size == 0) {
+    return;
+  }
+  idx_t line = 0;
+  while (line <= size) {
+    idx_t line_end = line;
+    while (line_end < size && data[line_end] != '\n') {
+      line_end++;
+    }
+    idx_t first_char = line;
+    while (first_char < line_end &&
+           (data[first_char] == ' ' || data[first_char] == '\t' ||
+            data[first_char] == '\r')) {
+      first_char++;
+    }
+    if (first_char == line_end) {
+      throw InvalidInputException(
+          "COPY ... (FORMAT sdf) cannot write the value of column \"%s\": it "
+          "has a blank line, which would end the value in the SDF file",
+          name);
+    }
+    if (line_end - line >= 4 && memcmp(data + line, "$$$$", 4) == 0) {
+      throw InvalidInputException(
+          "COPY ... (FORMAT sdf) cannot write the value of column \"%s\": it "
+          "has a line that starts with $$$$, which would end the record in the "
+          "SDF file",
+          name);
+    }
+    line = line_end + 1;
+  }
+}
+
+//! Appends the records of the rows of the chunk to out
+static void WriteSDFRecords(ClientContext &context,
+                            const SDFWriteBindData &bind_data, DataChunk &chunk,
+                            string &out) {
+  auto count = chunk.size();
+  //! the properties are written as their text, which is their VARCHAR cast.
+  //! Other Mol columns are written as SMILES
+  vector<Vector> text;
+  for (idx_t c = 0; c < chunk.ColumnCount(); c++) {
+    text.emplace_back(LogicalType::VARCHAR, count);
+    if (c != bind_data.mol_col_idx) {
+      VectorOperations::Cast(context, chunk.data[c], text.back(), count);
+    }
+  }
+  vector<UnifiedVectorFormat> text_data(text.size());
+  for (idx_t c = 0; c < text.size(); c++) {
+    text[c].ToUnifiedFormat(count, text_data[c]);
+  }
+  UnifiedVectorFormat mol_data;
+  chunk.data[bind_data.mol_col_idx].ToUnifiedFormat(count, mol_data);
+  auto mols = UnifiedVectorFormat::GetData<string_t>(mol_data);
+
+  for (idx_t i = 0; i < count; i++) {
+    auto mol_idx = mol_data.sel->get_index(i);
+    if (mol_data.validity.RowIsValid(mol_idx)) {
+      auto bmol = mols[mol_idx];
+      auto mol = rdkit_umbra_mol_to_mol(umbra_mol_t(bmol));
+      out += RDKit::MolToMolBlock(*mol);
+    } else {
+      out += RDKit::MolToMolBlock(RDKit::ROMol());
+    }
+
+    for (idx_t c = 0; c < text.size(); c++) {
+      auto idx = text_data[c].sel->get_index(i);
+      if (c == bind_data.mol_col_idx ||
+          !text_data[c].validity.RowIsValid(idx)) {
+        continue;
+      }
+      auto value = UnifiedVectorFormat::GetData<string_t>(text_data[c])[idx];
+      CheckPropertyValue(bind_data.names[c], value);
+      out += "> <";
+      out += bind_data.names[c];
+      out += ">\n";
+      out.append(value.GetData(), value.GetSize());
+      out += "\n\n";
+    }
+    out += "$$$$\n";
+  }
+}
+
+static void SDFWriteSink(ExecutionContext &context, FunctionData &bind_data_p,
+                         GlobalFunctionData &gstate_p,
+                         LocalFunctionData &lstate_p, DataChunk &input) {
+  auto &bind_data = bind_data_p.Cast<SDFWriteBindData>();
+  auto &gstate = gstate_p.Cast<SDFWriteGlobalState>();
+  auto &lstate = lstate_p.Cast<SDFWriteLocalState>();
+  WriteSDFRecords(context.client, bind_data, input, lstate.buffer);
+  if (lstate.buffer.size() >= SDF_WRITE_FLUSH_SIZE) {
+    gstate.WriteData(lstate.buffer);
+    lstate.buffer.clear();
+  }
+}
+
+static void SDFWriteCombine(ExecutionContext &, FunctionData &,
+                            GlobalFunctionData &gstate_p,
+                            LocalFunctionData &lstate_p) {
+  auto &gstate = gstate_p.Cast<SDFWriteGlobalState>();
+  auto &lstate = lstate_p.Cast<SDFWriteLocalState>();
+  if (!lstate.buffer.empty()) {
+    gstate.WriteData(lstate.buffer);
+    lstate.buffer.clear();
+  }
+}
+
+static void SDFWriteFinalize(ClientContext &, FunctionData &,
+                             GlobalFunctionData &gstate_p) {
+  auto &gstate = gstate_p.Cast<SDFWriteGlobalState>();
+  gstate.handle->Close();
+  gstate.handle.reset();
+}
+
+static CopyFunctionExecutionMode
+SDFWriteExecutionMode(bool preserve_insertion_order,
+                      bool supports_batch_index) {
+  if (!preserve_insertion_order) {
+    return CopyFunctionExecutionMode::PARALLEL_COPY_TO_FILE;
+  }
+  if (supports_batch_index) {
+    return CopyFunctionExecutionMode::BATCH_COPY_TO_FILE;
+  }
+  return CopyFunctionExecutionMode::REGULAR_COPY_TO_FILE;
+}
+
+//! Writes the records of a batch into a buffer, in parallel with the other
+//! batches
+static unique_ptr<PreparedBatchData>
+SDFWritePrepareBatch(ClientContext &context, FunctionData &bind_data_p,
+                     GlobalFunctionData &,
+                     unique_ptr<ColumnDataCollection> collection) {
+  auto &bind_data = bind_data_p.Cast<SDFWriteBindData>();
+  auto result = make_uniq<SDFWriteBatchData>();
+  for (auto &chunk : collection->Chunks()) {
+    WriteSDFRecords(context, bind_data, chunk, result->data);
+  }
+  return std::move(result);
+}
+
+//! Appends the buffer of a batch to the file, called in the order of the
+//! batches
+static void SDFWriteFlushBatch(ClientContext &, FunctionData &,
+                               GlobalFunctionData &gstate_p,
+                               PreparedBatchData &batch) {
+  auto &gstate = gstate_p.Cast<SDFWriteGlobalState>();
+  gstate.WriteData(batch.Cast<SDFWriteBatchData>().data);
+}
+
+CopyFunction GetSDFCopyFunction() {
+  CopyFunction function("sdf");
+  function.copy_to_bind = SDFWriteBind;
+  function.copy_to_initialize_global = SDFWriteInitializeGlobal;
+  function.copy_to_initialize_local = SDFWriteInitializeLocal;
+  function.copy_to_sink = SDFWriteSink;
+  function.copy_to_combine = SDFWriteCombine;
+  function.copy_to_finalize = SDFWriteFinalize;
+  function.execution_mode = SDFWriteExecutionMode;
+  function.prepare_batch = SDFWritePrepareBatch;
+  function.flush_batch = SDFWriteFlushBatch;
+  function.extension = "sdf";
+  return function;
+}
+
+} // namespace duckdb
@@ -0,0 +1,426 @@
+#include "similarity_search.hpp"
+#include "bit_fp.hpp"
+#include "common.hpp"
+#include "duckdb/common/exception.hpp"
+#include "duckdb/common/types/vector.hpp"
+#include "duckdb/execution/expression_executor.hpp"
+#include "duckdb/function/aggregate_function.hpp"
+#include "duckdb/function/function_set.hpp"
+#include "duckdb/function/table_function.hpp"
+#include "duckdb/parser/keyword_helper.hpp"
+#include "duckdb/parser/parser.hpp"
+#include "duckdb/parser/qualified_name.hpp"
+#include "duckdb/parser/statement/select_statement.hpp"
+#include "duckdb/parser/tableref/subqueryref.hpp"
+#include "mol_fingerprint.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace duckdb {
+
+// The Swamidass-Baldi bound: a fingerprint with a_count bits set, and one
+// with b_count bits set cannot be more similar than this, no matter which
+// bits are set.
+// Swamidass, S.J.; Baldi, P. (2007) 'Bounds and Algorithms for Fast Exact
+// Searches of Chemical Fingerprints in Linear and Sublinear Time', J. Chem.
+// Inf. Model., 47(2), 302-317
+static double tanimoto_upper_bound(uint32_t a_count, uint32_t b_count) {
+  auto max_count = std::max(a_count, b_count);
+  if (max_count == 0) {
+    return 1.0;
+  }
+  return double(std::min(a_count, b_count)) / double(max_count);
+}
+
+//===--------------------------------------------------------------------===//
+// tanimoto_top_k aggregate
+//===--------------------------------------------------------------------===//
+struct SimilarityHit {
+  double similarity;
+  int64_t id;
+
+  // more similar first, and the lowest id if equally similar, so that the
+  // results do not depend on how the rows were split between threads
+  bool operator<(const SimilarityHit &other) const {
+    if (similarity != other.similarity) {
+      return similarity > other.similarity;
+    }
+    return id < other.id;
+  }
+};
+
+// The k most similar fingerprints seen so far. This is a heap where the
+// least similar hit is at the front, so that it can be replaced when a more
+// similar one comes along
+struct SimilarityHeap {
+  // k comes from the user and can be much larger than the number of hits, so
+  // reserve at most a chunk of hits up front and let the heap grow
+  explicit SimilarityHeap(idx_t k_p) : k(k_p) {
+    hits.reserve(MinValue<idx_t>(k, STANDARD_VECTOR_SIZE));
+  }
+
+  bool IsFull() const { return hits.size() >= k; }
+
+  // The least similar hit that is kept
+  const SimilarityHit &Worst() const { return hits.front(); }
+
+  void Insert(const SimilarityHit &hit) {
+    if (!IsFull()) {
+      hits.push_back(hit);
+      std::push_heap(hits.begin(), hits.end());
+    } else if (hit < Worst()) {
+      std::pop_heap(hits.begin(), hits.end());
+      hits.back() = hit;
+      std::push_heap(hits.begin(), hits.end());
+    }
+  }
+
+  idx_t k;
+  std::vector<SimilarityHit> hits;
+};
+
+struct TopKBindData : public FunctionData {
+  TopKBindData(std::string query_p, idx_t k_p, double threshold_p)
+      : query(std::move(query_p)), k(k_p), threshold(threshold_p) {
+    query_popcount = bit_fp_t::DecodePopcount(query.data());
+  }
+
+  // the BitFP to compare against
+  std::string query;
+  uint32_t query_popcount;
+  idx_t k;
+  // hits less similar than this are never returned
+  double threshold;
+
+  unique_ptr<FunctionData> Copy() const override {
+    return make_uniq<TopKBindData>(query, k, threshold);
+  }
+
+  bool Equals(const FunctionData &other_p) const override {
+    auto &other = other_p.Cast<TopKBindData>();
+    return query == other.query && k == other.k &&
+           threshold == other.threshold;
+  }
+};
+
+// Each thread aggregates into its own state, so each thread has its own
+// bounded heap. The heaps are merged in Combine
+struct TopKState {
+  SimilarityHeap *heap;
+};
+
+struct TanimotoTopKOperation {
+  template <class STATE> static void Initialize(STATE &state) {
+    state.heap = nullptr;
+  }
+
+  template <class A_TYPE, class B_TYPE, class STATE, class OP>
+  static void Operation(STATE &state, const A_TYPE &fp_blob, const B_TYPE &id,
+                        AggregateBinaryInput &idata) {
+    auto &bind_data = idata.input.bind_data->template Cast<TopKBindData>();
+    if (!state.heap) {
+      state.heap = new SimilarityHeap(bind_data.k);
+    }
+    auto &heap = *state.heap;
+
+    // Once the heap is full, a fingerprint has to be more similar than the
+    // worst hit to make it in. Check the popcount bound first, it only needs
+    // the popcounts, which are inlined in the string_t
+    auto target_blob = fp_blob;
+    auto target = bit_fp_t(target_blob);
+    auto bound =
+        tanimoto_upper_bound(bind_data.query_popcount, target.GetPopcount());
+    if (bound < bind_data.threshold) {
+      return;
+    }
+    if (heap.IsFull() && bound < heap.Worst().similarity) {
+      return;
+    }
+
+    auto query_blob = string_t(bind_data.query.data(),
+                               UnsafeNumericCast<uint32_t>(bind_data.query.size()));
+    auto similarity = tanimoto_similarity(target, bit_fp_t(query_blob));
+    if (similarity < bind_data.threshold) {
+      return;
+    }
+    heap.Insert(SimilarityHit {similarity, id});
+  }
+
+  template <class STATE, class OP>
+  static void Combine(const STATE &source, STATE &target,
+                      AggregateInputData &) {
+    if (!source.heap) {
+      return;
+    }
+    if (!target.heap) {
+      target.heap = new SimilarityHeap(*source.heap);
+      return;
+    }
+    for (auto &hit : source.heap->hits) {
+      target.heap->Insert(hit);
+    }
+  }
+
+  template <class STATE> static void Destroy(STATE &state, AggregateInputData &) {
+    delete state.heap;
+    state.heap = nullptr;
+  }
+
+  static bool IgnoreNull() { return true; }
+};
+
+// Writes the hits of each state as a LIST(STRUCT(id, similarity)), most
+// similar first
+static void TanimotoTopKFinalize(Vector &state_vector,
+                                 AggregateInputData &aggr_input_data,
+                                 Vector &result, idx_t count, idx_t offset) {
+  UnifiedVectorFormat sdata;
+  state_vector.ToUnifiedFormat(count, sdata);
+  auto states = UnifiedVectorFormat::GetData<TopKState *>(sdata);
+
+  auto list_entries = FlatVector::GetData<list_entry_t>(result);
+  auto list_size = ListVector::GetListSize(result);
+  for (idx_t i = 0; i < count; i++) {
+    auto &state = *states[sdata.sel->get_index(i)];
+    auto rid = i + offset;
+    list_entries[rid].offset = list_size;
+    list_entries[rid].length = 0;
+    if (!state.heap) {
+      continue;
+    }
+
+    auto &hits = state.heap->hits;
+    std::sort(hits.begin(), hits.end());
+    ListVector::Reserve(result, list_size + hits.size());
+    auto &child = ListVector::GetEntry(result);
+    auto &struct_children = StructVector::GetEntries(child);
+    auto ids = FlatVector::GetData<int64_t>(*struct_children[0]);
+    auto similarities = FlatVector::GetData<double>(*struct_children[1]);
+    for (auto &hit : hits) {
+      ids[list_size] = hit.id;
+      similarities[list_size] = hit.similarity;
+      list_size++;
+    }
+    list_entries[rid].length = hits.size();
+  }
+  ListVector::SetListSize(result, list_size);
+}
+
+static unique_ptr<FunctionData>
+TanimotoTopKBind(ClientContext &context, AggregateFunction &function,
+                 vector<unique_ptr<Expression>> &arguments) {
+  D_ASSERT(arguments.size() == 5);
+  for (idx_t i = 2; i < arguments.size(); i++) {
+    if (arguments[i]->HasParameter() || !arguments[i]->IsFoldable()) {
+      throw BinderException(
+          "tanimoto_top_k: query, k and threshold must be constants");
+    }
+  }
+  auto query = ExpressionExecutor::EvaluateScalar(context, *arguments[2]);
+  auto k = ExpressionExecutor::EvaluateScalar(context, *arguments[3]);
+  auto threshold = ExpressionExecutor::EvaluateScalar(context, *arguments[4]);
+  if (query.IsNull() || k.IsNull() || threshold.IsNull()) {
+    throw BinderException(
+        "tanimoto_top_k: query, k and threshold cannot be NULL");
+  }
+  auto k_value = k.GetValue<int64_t>();
+  if (k_value <= 0) {
+    throw BinderException("tanimoto_top_k: k must be greater than 0");
+  }
+  auto threshold_value = threshold.GetValue<double>();
+  if (threshold_value < 0 || threshold_value > 1) {
+    throw BinderException(
+        "tanimoto_top_k: threshold must be between 0.0 and 1.0");
+  }
+  auto &query_blob = StringValue::Get(query);
+  if (query_blob.size() < bit_fp_t::POPCOUNT_BYTES) {
+    throw BinderException("tanimoto_top_k: query is not a BitFP");
+  }
+
+  // The constants are not needed per row anymore
+  Function::EraseArgument(function, arguments, 4);
+  Function::EraseArgument(function, arguments, 3);
+  Function::EraseArgument(function, arguments, 2);
+  return make_uniq<TopKBindData>(query_blob, idx_t(k_value), threshold_value);
+}
+
+static AggregateFunction GetTanimotoTopKFunction() {
+  auto return_type = LogicalType::LIST(LogicalType::STRUCT(
+      {{"id", LogicalType::BIGINT}, {"similarity", LogicalType::DOUBLE}}));
+  AggregateFunction function(
+      "tanimoto_top_k",
+      {BitFP(), LogicalType::BIGINT, BitFP(), LogicalType::INTEGER,
+       LogicalType::DOUBLE},
+      return_type, AggregateFunction::StateSize<TopKState>,
+      AggregateFunction::StateInitialize<TopKState, TanimotoTopKOperation>,
+      AggregateFunction::BinaryScatterUpdate<TopKState, string_t, int64_t,
+                                             TanimotoTopKOperation>,
+      AggregateFunction::StateCombine<TopKState, TanimotoTopKOperation>,
+      TanimotoTopKFinalize,
+      AggregateFunction::BinaryUpdate<TopKState, string_t, int64_t,
+                                      TanimotoTopKOperation>,
+      TanimotoTopKBind,
+      AggregateFunction::StateDestroy<TopKState, TanimotoTopKOperation>);
+  return function;
+}
+
+//===--------------------------------------------------------------------===//
+// similarity_search table function
+//===--------------------------------------------------------------------===//
+static constexpr int32_t DEFAULT_K = 10;
+static constexpr double DEFAULT_THRESHOLD = 0.0;
+// The relative error that the popcount bounds of the threshold are widened by
+static constexpr double POPCOUNT_BOUND_EPSILON = 1e-9;
+
+// Writes every byte as \xNN, so that the blob can be put in a SQL string
+// literal no matter what bytes it has
+static std::string blob_to_sql(const std::string &blob) {
+  static constexpr const char *HEX = "0123456789ABCDEF";
+  std::string result = "'";
+  for (auto c : blob) {
+    auto byte = uint8_t(c);
+    result += "\\x";
+    result += HEX[byte >> 4];
+    result += HEX[byte & 0x0F];
+  }
+  result += "'::BLOB::BitFP";
+  return result;
+}
+
+static std::string popcount_to_sql(uint32_t popcount) {
+  std::string blob(bit_fp_t::POPCOUNT_BYTES, '\0');
+  bit_fp_t::EncodePopcount(popcount, &blob[0]);
+  return blob_to_sql(blob);
+}
+
+// The threshold at full precision, so that tanimoto_top_k filters with the
+// same threshold the popcount bounds were computed with
+static std::string threshold_to_sql(double threshold) {
+  return StringUtil::Format("%.17g::DOUBLE", threshold);
+}
+
+std::string table_to_sql(const std::string &table_name) {
+  auto qualified_name = QualifiedName::Parse(table_name);
+  std::string result;
+  if (!qualified_name.catalog.empty()) {
+    result += KeywordHelper::WriteOptionallyQuoted(qualified_name.catalog) + ".";
+  }
+  if (!qualified_name.schema.empty()) {
+    result += KeywordHelper::WriteOptionallyQuoted(qualified_name.schema) + ".";
+  }
+  return result + KeywordHelper::WriteOptionallyQuoted(qualified_name.name);
+}
+
+// similarity_search is rewritten to a query over the table:
+//
+// - The popcount bounds that follow from the threshold become a range
+//   filter on the fingerprint column. Because the popcount is at the front
+//   of the BitFP (big endian), this is a range on the blob. duckdb pushes it
+//   into the table scan, where it skips whole row groups using the min/max
+//   of the column (the popcount range of the row group), and rows using the
+//   inlined prefix, without reading the fingerprint.
+// - tanimoto_top_k keeps a bounded heap per thread, and skips fingerprints
+//   whose popcount bound cannot beat the worst hit in the heap.
+// - Joining the k hits back on rowid lets duckdb push the hit row ids into
+//   the scan of the table, so only the hit rows are read again.
+static unique_ptr<TableRef>
+SimilaritySearchBindReplace(ClientContext &context,
+                            TableFunctionBindInput &input) {
+  for (auto &value : input.inputs) {
+    if (value.IsNull()) {
+      throw BinderException("similarity_search arguments cannot be NULL");
+    }
+  }
+  auto table_name = StringValue::Get(input.inputs[0]);
+  auto fp_column = StringValue::Get(input.inputs[1]);
+  auto &query = StringValue::Get(input.inputs[2]);
+  if (query.size() < bit_fp_t::POPCOUNT_BYTES) {
+    throw BinderException("similarity_search: query is not a BitFP");
+  }
+
+  int32_t k = DEFAULT_K;
+  double threshold = DEFAULT_THRESHOLD;
+  for (auto &kv : input.named_parameters) {
+    if (kv.second.IsNull()) {
+      throw BinderException("similarity_search parameter \"%s\" cannot be NULL.",
+                            kv.first);
+    }
+    auto loption = StringUtil::Lower(kv.first);
+    if (loption == "k") {
+      k = IntegerValue::Get(kv.second);
+    } else if (loption == "threshold") {
+      threshold = DoubleValue::Get(kv.second);
+    }
+  }
+  if (k <= 0) {
+    throw BinderException("similarity_search: k must be greater than 0");
+  }
+  if (threshold < 0 || threshold > 1) {
+    throw BinderException(
+        "similarity_search: threshold must be between 0.0 and 1.0");
+  }
+
+  auto table = table_to_sql(table_name);
+  auto fp = KeywordHelper::WriteOptionallyQuoted(fp_column);
+
+  // A fingerprint with b bits set can only reach the threshold t against a
+  // query with q bits set if t * q <= b <= q / t. The bounds are widened a
+  // little before rounding, so that a rounding error in the division or
+  // multiplication (e.g. 0.28 * 25 = 7.000000000000001) does not filter out a
+  // fingerprint that is exactly on the threshold. tanimoto_top_k checks the
+  // threshold itself, so a wider range only costs a few more comparisons
+  std::string popcount_filter;
+  if (threshold > 0) {
+    auto query_popcount = bit_fp_t::DecodePopcount(query.data());
+    auto lower = threshold * query_popcount;
+    auto upper = query_popcount / threshold;
+    auto min_popcount =
+        std::max(0.0, std::ceil(lower - POPCOUNT_BOUND_EPSILON *
+                                            std::max(1.0, lower)));
+    auto max_popcount =
+        std::floor(upper + POPCOUNT_BOUND_EPSILON * std::max(1.0, upper));
+    popcount_filter = StringUtil::Format(
+        " WHERE %s >= %s", fp, popcount_to_sql(uint32_t(min_popcount)));
+    if (max_popcount < double(NumericLimits<uint32_t>::Maximum())) {
+      popcount_filter += StringUtil::Format(
+          " AND %s < %s", fp, popcount_to_sql(uint32_t(max_popcount) + 1));
+    }
+  }
+
+  auto sql = StringUtil::Format(
+      "SELECT t.*, hits.similarity FROM ("
+      "SELECT UNNEST(tanimoto_top_k(%s, rowid, %s, %d, %s), recursive := true) "
+      "FROM %s%s) hits "
+      "JOIN %s t ON t.rowid = hits.id "
+      "ORDER BY hits.similarity DESC, hits.id",
+      fp, blob_to_sql(query), k, threshold_to_sql(threshold), table,
+      popcount_filter, table);
+
+  Parser parser(context.GetParserOptions());
+  parser.ParseQuery(sql);
+  if (parser.statements.size() != 1 ||
+      parser.statements[0]->type != StatementType::SELECT_STATEMENT) {
+    throw InternalException("similarity_search: could not rewrite the query");
+  }
+  auto select_stmt = unique_ptr_cast<SQLStatement, SelectStatement>(
+      std::move(parser.statements[0]));
+  return make_uniq<SubqueryRef>(std::move(select_stmt));
+}
+
+void RegisterSimilaritySearchFunctions(ExtensionLoader &loader) {
+  AggregateFunctionSet set_tanimoto_top_k("tanimoto_top_k");
+  set_tanimoto_top_k.AddFunction(GetTanimotoTopKFunction());
+  loader.RegisterFunction(set_tanimoto_top_k);
+
+  TableFunction similarity_search(
+      "similarity_search",
+      {LogicalType::VARCHAR, LogicalType::VARCHAR, BitFP()}, nullptr, nullptr);
+  similarity_search.bind_replace = SimilaritySearchBindReplace;
+  similarity_search.named_parameters["k"] = LogicalType::INTEGER;
+  similarity_search.named_parameters["threshold"] = LogicalType::DOUBLE;
+  loader.RegisterFunction(similarity_search);
+}
+
+} // namespace duckdb
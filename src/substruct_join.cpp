@@ -0,0 +1,410 @@
+#include "substruct_join.hpp"
+#include "common.hpp"
+#include "duckdb/common/bit_utils.hpp"
+#include "duckdb/common/exception.hpp"
+#include "duckdb/common/types/vector.hpp"
+#include "duckdb/execution/expression_executor_state.hpp"
+#include "duckdb/function/aggregate_function.hpp"
+#include "duckdb/function/function_set.hpp"
+#include "duckdb/function/table_function.hpp"
+#include "duckdb/parser/keyword_helper.hpp"
+#include "duckdb/parser/parser.hpp"
+#include "duckdb/parser/statement/select_statement.hpp"
+#include "duckdb/parser/tableref/subqueryref.hpp"
+#include "mol_cache.hpp"
+#include "mol_formats.hpp"
+#include "similarity_search.hpp"
+#include "types.hpp"
+#include "umbra_mol.hpp"
+#include <GraphMol/GraphMol.h>
+#include <GraphMol/Substruct/SubstructMatch.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace duckdb {
+
+//===--------------------------------------------------------------------===//
+// mol_fragment_library aggregate
+//===--------------------------------------------------------------------===//
+// The library is a BLOB with the number of fragments, followed by the id,
+// size and umbra_mol of each fragment, in the order of the ids
+struct LibraryFragment {
+  int64_t id;
+  std::string umbra_mol;
+
+  bool operator<(const LibraryFragment &other) const { return id < other.id; }
+};
+
+struct FragmentLibraryState {
+  std::vector<LibraryFragment> *fragments;
+};
+
+struct FragmentLibraryOperation {
+  template <class STATE> static void Initialize(STATE &state) {
+    state.fragments = nullptr;
+  }
+
+  template <class A_TYPE, class B_TYPE, class STATE, class OP>
+  static void Operation(STATE &state, const A_TYPE &umbra_mol, const B_TYPE &id,
+                        AggregateBinaryInput &) {
+    if (!state.fragments) {
+      state.fragments = new std::vector<LibraryFragment>();
+    }
+    state.fragments->push_back(
+        {id, std::string(umbra_mol.GetData(), umbra_mol.GetSize())});
+  }
+
+  template <class STATE, class OP>
+  static void Combine(const STATE &source, STATE &target,
+                      AggregateInputData &) {
+    if (!source.fragments) {
+      return;
+    }
+    if (!target.fragments) {
+      target.fragments = new std::vector<LibraryFragment>(*source.fragments);
+      return;
+    }
+    target.fragments->insert(target.fragments->end(),
+                             source.fragments->begin(),
+                             source.fragments->end());
+  }
+
+  template <class STATE> static void Destroy(STATE &state, AggregateInputData &) {
+    delete state.fragments;
+    state.fragments = nullptr;
+  }
+
+  static bool IgnoreNull() { return true; }
+};
+
+static void FragmentLibraryFinalize(Vector &state_vector,
+                                    AggregateInputData &aggr_input_data,
+                                    Vector &result, idx_t count, idx_t offset) {
+  UnifiedVectorFormat sdata;
+  state_vector.ToUnifiedFormat(count, sdata);
+  auto states = UnifiedVectorFormat::GetData<FragmentLibraryState *>(sdata);
+  auto result_data = FlatVector::GetData<string_t>(result);
+
+  for (idx_t i = 0; i < count; i++) {
+    auto &state = *states[sdata.sel->get_index(i)];
+    std::vector<LibraryFragment> empty;
+    auto &fragments = state.fragments ? *state.fragments : empty;
+    // the threads combine their fragments in any order
+    std::sort(fragments.begin(), fragments.end());
+
+    std::string library;
+    uint64_t fragment_count = fragments.size();
+    library.append(reinterpret_cast<const char *>(&fragment_count),
+                   sizeof(uint64_t));
+    for (auto &fragment : fragments) {
+      auto size = static_cast<uint32_t>(fragment.umbra_mol.size());
+      library.append(reinterpret_cast<const char *>(&fragment.id),
+                     sizeof(int64_t));
+      library.append(reinterpret_cast<const char *>(&size), sizeof(uint32_t));
+      library.append(fragment.umbra_mol);
+    }
+    result_data[i + offset] = StringVector::AddStringOrBlob(result, library);
+  }
+}
+
+static AggregateFunction GetFragmentLibraryFunction() {
+  AggregateFunction function(
+      "mol_fragment_library", {Mol(), LogicalType::BIGINT}, LogicalType::BLOB,
+      AggregateFunction::StateSize<FragmentLibraryState>,
+      AggregateFunction::StateInitialize<FragmentLibraryState,
+                                         FragmentLibraryOperation>,
+      AggregateFunction::BinaryScatterUpdate<FragmentLibraryState, string_t,
+                                             int64_t, FragmentLibraryOperation>,
+      AggregateFunction::StateCombine<FragmentLibraryState,
+                                      FragmentLibraryOperation>,
+      FragmentLibraryFinalize,
+      AggregateFunction::BinaryUpdate<FragmentLibraryState, string_t, int64_t,
+                                      FragmentLibraryOperation>,
+      nullptr,
+      AggregateFunction::StateDestroy<FragmentLibraryState,
+                                      FragmentLibraryOperation>);
+  return function;
+}
+
+//===--------------------------------------------------------------------===//
+// substruct_matches
+//===--------------------------------------------------------------------===//
+// The number of bits of the dalke fp (screen word)
+static constexpr idx_t SCREEN_BITS = 55;
+
+// A fragment library that is deserialized, with its fragments grouped by
+// their screen word.
+//
+// A fragment can only be a substructure of a compound if every screen bit of
+// the fragment is also set in the compound. For each screen bit, the groups
+// that have it set are kept as a bitset, so the groups that can match a
+// compound are found with one AND NOT per bit that the compound does not
+// have, instead of a screen test per fragment.
+struct CompiledFragmentLibrary {
+  struct Fragment {
+    int64_t id;
+    std::unique_ptr<RDKit::ROMol> mol;
+  };
+  struct ScreenGroup {
+    uint64_t screen;
+    // indexes into fragments
+    std::vector<idx_t> fragments;
+  };
+
+  explicit CompiledFragmentLibrary(const string_t &library);
+
+  // Sets candidates to the bitset of the groups whose screen is contained in
+  // the screen of the compound
+  void GetCandidateGroups(uint64_t screen,
+                          std::vector<uint64_t> &candidates) const;
+
+  std::vector<Fragment> fragments;
+  std::vector<ScreenGroup> groups;
+  // the number of 64-bit words of a bitset of the groups
+  idx_t group_words = 0;
+  // for each screen bit, the bitset of the groups that have it set
+  std::vector<std::vector<uint64_t>> groups_with_bit;
+};
+
+CompiledFragmentLibrary::CompiledFragmentLibrary(const string_t &library) {
+  auto data = const_data_ptr_cast(library.GetData());
+  auto end = data + library.GetSize();
+  auto read = [&](idx_t size) {
+    if (data + size > end) {
+      throw InvalidInputException(
+          "substruct_matches: the library is not a mol_fragment_library");
+    }
+    auto result = data;
+    data += size;
+    return result;
+  };
+
+  auto fragment_count = Load<uint64_t>(read(sizeof(uint64_t)));
+  std::unordered_map<uint64_t, idx_t> group_of_screen;
+  for (uint64_t i = 0; i < fragment_count; i++) {
+    auto id = Load<int64_t>(read(sizeof(int64_t)));
+    auto size = Load<uint32_t>(read(sizeof(uint32_t)));
+    auto blob = string_t(const_char_ptr_cast(read(size)), size);
+    auto umbra_mol = umbra_mol_t(blob);
+
+    auto screen = umbra_mol.GetDalkeFP();
+    auto entry = group_of_screen.find(screen);
+    if (entry == group_of_screen.end()) {
+      entry = group_of_screen.emplace(screen, groups.size()).first;
+      groups.push_back({screen, {}});
+    }
+    groups[entry->second].fragments.push_back(fragments.size());
+    fragments.push_back({id, rdkit_umbra_mol_to_mol(umbra_mol)});
+  }
+
+  group_words = (groups.size() + 63) / 64;
+  groups_with_bit.assign(SCREEN_BITS, std::vector<uint64_t>(group_words, 0));
+  for (idx_t g = 0; g < groups.size(); g++) {
+    auto screen = groups[g].screen;
+    while (screen) {
+      auto bit = CountZeros<uint64_t>::Trailing(screen);
+      groups_with_bit[bit][g / 64] |= uint64_t(1) << (g % 64);
+      screen &= screen - 1;
+    }
+  }
+}
+
+void CompiledFragmentLibrary::GetCandidateGroups(
+    uint64_t screen, std::vector<uint64_t> &candidates) const {
+  candidates.assign(group_words, ~uint64_t(0));
+  if (groups.size() % 64 != 0) {
+    candidates.back() = (uint64_t(1) << (groups.size() % 64)) - 1;
+  }
+  // a group that has a bit the compound does not have cannot match
+  uint64_t missing = ~screen & umbra_mol_t::DALKE_FP_MASK;
+  while (missing) {
+    auto &with_bit = groups_with_bit[CountZeros<uint64_t>::Trailing(missing)];
+    for (idx_t w = 0; w < group_words; w++) {
+      candidates[w] &= ~with_bit[w];
+    }
+    missing &= missing - 1;
+  }
+}
+
+// Each thread deserializes the library once. The library is the same for
+// every row in the rewritten query of substruct_join, so it is only compiled
+// again if it changes
+struct SubstructMatchesLocalState : public FunctionLocalState {
+  const CompiledFragmentLibrary &GetLibrary(const string_t &blob) {
+    // within a chunk, the same library has the same data pointer. Compare
+    // the bytes once per chunk, it could have been reused for another value
+    if (library && blob.GetData() == last_data &&
+        blob.GetSize() == library_blob.size()) {
+      return *library;
+    }
+    if (!library || blob.GetSize() != library_blob.size() ||
+        memcmp(blob.GetData(), library_blob.data(), blob.GetSize()) != 0) {
+      library = make_uniq<CompiledFragmentLibrary>(blob);
+      library_blob.assign(blob.GetData(), blob.GetSize());
+    }
+    last_data = blob.GetData();
+    return *library;
+  }
+
+  unique_ptr<CompiledFragmentLibrary> library;
+  // the library that was compiled
+  std::string library_blob;
+  const char *last_data = nullptr;
+  // buffers reused for every row
+  std::vector<uint64_t> candidates;
+  std::vector<int64_t> matches;
+};
+
+static unique_ptr<FunctionLocalState>
+SubstructMatchesInitLocalState(ExpressionState &state,
+                               const BoundFunctionExpression &expr,
+                               FunctionData *bind_data) {
+  return make_uniq<SubstructMatchesLocalState>();
+}
+
+// substruct_matches(mol, library): the ids of the fragments of the library
+// that are substructures of mol, in order. The compound is deserialized once,
+// and only matched against the fragments that pass the screen
+static void substruct_matches(DataChunk &args, ExpressionState &state,
+                              Vector &result) {
+  D_ASSERT(args.ColumnCount() == 2);
+  auto count = args.size();
+  auto &lstate = ExecuteFunctionState::GetFunctionState(state)
+                     ->Cast<SubstructMatchesLocalState>();
+  auto &cache = DecodedMolCache::Get(state);
+  lstate.last_data = nullptr;
+
+  UnifiedVectorFormat mol_data;
+  UnifiedVectorFormat library_data;
+  args.data[0].ToUnifiedFormat(count, mol_data);
+  args.data[1].ToUnifiedFormat(count, library_data);
+  auto mols = UnifiedVectorFormat::GetData<string_t>(mol_data);
+  auto libraries = UnifiedVectorFormat::GetData<string_t>(library_data);
+
+  result.SetVectorType(VectorType::FLAT_VECTOR);
+  auto list_entries = FlatVector::GetData<list_entry_t>(result);
+  auto &validity = FlatVector::Validity(result);
+  idx_t list_size = ListVector::GetListSize(result);
+  for (idx_t i = 0; i < count; i++) {
+    auto mol_idx = mol_data.sel->get_index(i);
+    auto library_idx = library_data.sel->get_index(i);
+    if (!mol_data.validity.RowIsValid(mol_idx) ||
+        !library_data.validity.RowIsValid(library_idx)) {
+      validity.SetInvalid(i);
+      continue;
+    }
+    auto &library = lstate.GetLibrary(libraries[library_idx]);
+    auto mol_blob = mols[mol_idx];
+    auto umbra_mol = umbra_mol_t(mol_blob);
+
+    auto &matches = lstate.matches;
+    matches.clear();
+    library.GetCandidateGroups(umbra_mol.GetDalkeFP(), lstate.candidates);
+    std::shared_ptr<const RDKit::ROMol> mol;
+    for (idx_t w = 0; w < library.group_words; w++) {
+      auto word = lstate.candidates[w];
+      while (word) {
+        auto g = w * 64 + CountZeros<uint64_t>::Trailing(word);
+        word &= word - 1;
+        if (!mol) {
+          mol = cache.GetMol(umbra_mol);
+        }
+        for (auto f : library.groups[g].fragments) {
+          auto &fragment = library.fragments[f];
+          // the same parameters as is_substruct
+          RDKit::MatchVectType match_vect;
+          bool recursion_possible = true;
+          bool do_chiral_match = false;
+          if (RDKit::SubstructMatch(*mol, *fragment.mol, match_vect,
+                                    recursion_possible, do_chiral_match)) {
+            matches.push_back(fragment.id);
+          }
+        }
+      }
+    }
+    std::sort(matches.begin(), matches.end());
+
+    list_entries[i].offset = list_size;
+    list_entries[i].length = matches.size();
+    ListVector::Reserve(result, list_size + matches.size());
+    auto ids = FlatVector::GetData<int64_t>(ListVector::GetEntry(result));
+    for (auto id : matches) {
+      ids[list_size++] = id;
+    }
+  }
+  ListVector::SetListSize(result, list_size);
+  if (args.AllConstant()) {
+    result.SetVectorType(VectorType::CONSTANT_VECTOR);
+  }
+}
+
+//===--------------------------------------------------------------------===//
+// substruct_join table function
+//===--------------------------------------------------------------------===//
+// substruct_join is rewritten to a query over the two tables:
+//
+// - The fragments are collected into a library by mol_fragment_library, once
+//   for the query, in an uncorrelated subquery.
+// - substruct_matches matches each compound against the whole library. The
+//   compound is decoded once, and only matched against the fragments that
+//   pass the screen, instead of evaluating is_substruct on the cross
+//   product, which decodes the compound once per fragment.
+// - The ids of the matching fragments are unnested, and joined back on the
+//   rowid of the fragments.
+static unique_ptr<TableRef>
+SubstructJoinBindReplace(ClientContext &context,
+                         TableFunctionBindInput &input) {
+  for (auto &value : input.inputs) {
+    if (value.IsNull()) {
+      throw BinderException("substruct_join arguments cannot be NULL");
+    }
+  }
+  auto compounds = table_to_sql(StringValue::Get(input.inputs[0]));
+  auto compound_mol =
+      KeywordHelper::WriteOptionallyQuoted(StringValue::Get(input.inputs[1]));
+  auto fragments = table_to_sql(StringValue::Get(input.inputs[2]));
+  auto fragment_mol =
+      KeywordHelper::WriteOptionallyQuoted(StringValue::Get(input.inputs[3]));
+
+  auto sql = StringUtil::Format(
+      "SELECT hits.* EXCLUDE (__fragment_id), f AS fragment FROM ("
+      "SELECT c.*, UNNEST(substruct_matches(c.%s, "
+      "(SELECT mol_fragment_library(%s, rowid) FROM %s))) AS __fragment_id "
+      "FROM %s c) hits "
+      "JOIN %s f ON f.rowid = hits.__fragment_id",
+      compound_mol, fragment_mol, fragments, compounds, fragments);
+
+  Parser parser(context.GetParserOptions());
+  parser.ParseQuery(sql);
+  if (parser.statements.size() != 1 ||
+      parser.statements[0]->type != StatementType::SELECT_STATEMENT) {
+    throw InternalException("substruct_join: could not rewrite the query");
+  }
+  auto select_stmt = unique_ptr_cast<SQLStatement, SelectStatement>(
+      std::move(parser.statements[0]));
+  return make_uniq<SubqueryRef>(std::move(select_stmt));
+}
+
+void RegisterSubstructJoinFunctions(ExtensionLoader &loader) {
+  AggregateFunctionSet set_mol_fragment_library("mol_fragment_library");
+  set_mol_fragment_library.AddFunction(GetFragmentLibraryFunction());
+  loader.RegisterFunction(set_mol_fragment_library);
+
+  ScalarFunctionSet set_substruct_matches("substruct_matches");
+  ScalarFunction substruct_matches_fun(
+      {Mol(), LogicalType::BLOB}, LogicalType::LIST(LogicalType::BIGINT),
+      substruct_matches);
+  substruct_matches_fun.init_local_state = SubstructMatchesInitLocalState;
+  set_substruct_matches.AddFunction(substruct_matches_fun);
+  loader.RegisterFunction(set_substruct_matches);
+
+  TableFunction substruct_join("substruct_join",
+                               {LogicalType::VARCHAR, LogicalType::VARCHAR,
+                                LogicalType::VARCHAR, LogicalType::VARCHAR},
+                               nullptr, nullptr);
+  substruct_join.bind_replace = SubstructJoinBindReplace;
+  loader.RegisterFunction(substruct_join);
+}
+
+} // namespace duckdb
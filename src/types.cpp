@@ -9,8 +9,15 @@ LogicalType Mol() {
   return blob_type;
 }
 
+LogicalType BitFP() {
+  auto blob_type = LogicalType(LogicalTypeId::BLOB);
+  blob_type.SetAlias("BitFP");
+  return blob_type;
+}
+
 void RegisterTypes(ExtensionLoader &loader) {
   loader.RegisterType("Mol", Mol());
+  loader.RegisterType("BitFP", BitFP());
 }
 
 } // namespace duckdb
@@ -4,8 +4,12 @@
 #include "mol_formats.hpp"
 #include <GraphMol/SmilesParse/SmilesParse.h>
 #include <GraphMol/Substruct/SubstructMatch.h>
+#include <RDGeneral/versions.h>
+#include <algorithm>
 #include <cstdint>
+#include <cstdio>
 #include <string>
+#include <vector>
 
 namespace duckdb {
 
@@ -22,58 +26,107 @@ namespace duckdb {
 // This is used for a substructure filter and placed in the prefix of a
 // Umbra-mol so that short-circuiting can take place and save on computation
 // cost when deserializing and a full substructure search is unnecessary.
-std::vector<std::vector<string>> dalke_counts = {{"O", "2", "3", "1", "4", "5"},
-                                                 {"Ccc", "2", "4"},
-                                                 {"CCN", "1"},
-                                                 {"cnc", "1"},
-                                                 {"cN", "1"},
-                                                 {"C=O", "1"},
-                                                 {"CCC", "1"},
-                                                 {"S", "1"},
-                                                 {"c1ccccc1", "1", "2"},
-                                                 {"N", "2", "3", "1"},
-                                                 {"C=C", "1"},
-                                                 {"nn", "1"},
-                                                 {"CO", "2"},
-                                                 {"Ccn", "1", "2"},
-                                                 {"CCCCC", "1"},
-                                                 {"cc(c)c", "1"},
-                                                 {"CNC", "2"},
-                                                 {"s", "1"},
-                                                 {"CC(C)C", "1"},
-                                                 {"o", "1"},
-                                                 {"cncnc", "1"},
-                                                 {"C=N", "1"},
-                                                 {"CC=O", "2", "3"},
-                                                 {"Cl", "1"},
-                                                 {"ccncc", "2"},
-                                                 {"CCCCCC", "6"},
-                                                 {"F", "1"},
-                                                 {"CCOC", "3"},
-                                                 {"c(cn)n", "1"},
-                                                 {"C", "9", "6", "1"},
-                                                 {"CC=C(C)C", "1"},
-                                                 {"c1ccncc1", "1"},
-                                                 {"CC(C)N", "1"},
-                                                 {"CC", "1"},
-                                                 {"CCC(C)O", "4"},
-                                                 {"ccc(cc)n", "2"},
-                                                 {"C1CCCC1", "1"},
-                                                 {"CNCN", "1"},
-                                                 {"cncn", "3"},
-                                                 {"CSC", "1"},
-                                                 {"CCNCCCN", "1"},
-                                                 {"CccC", "1"},
-                                                 {"ccccc(c)c", "3"}};
+//
+// NOTE: the order of the fragments and of the counts must not change. The
+// bits are stored with every molecule, so changing the order would make
+// is_substruct return wrong results for molecules that are already stored
+struct DalkeCount {
+  std::string smiles;
+  std::vector<unsigned int> counts;
+};
+
+static const std::vector<DalkeCount> dalke_counts = {
+    {"O", {2, 3, 1, 4, 5}},
+    {"Ccc", {2, 4}},
+    {"CCN", {1}},
+    {"cnc", {1}},
+    {"cN", {1}},
+    {"C=O", {1}},
+    {"CCC", {1}},
+    {"S", {1}},
+    {"c1ccccc1", {1, 2}},
+    {"N", {2, 3, 1}},
+    {"C=C", {1}},
+    {"nn", {1}},
+    {"CO", {2}},
+    {"Ccn", {1, 2}},
+    {"CCCCC", {1}},
+    {"cc(c)c", {1}},
+    {"CNC", {2}},
+    {"s", {1}},
+    {"CC(C)C", {1}},
+    {"o", {1}},
+    {"cncnc", {1}},
+    {"C=N", {1}},
+    {"CC=O", {2, 3}},
+    {"Cl", {1}},
+    {"ccncc", {2}},
+    {"CCCCCC", {6}},
+    {"F", {1}},
+    {"CCOC", {3}},
+    {"c(cn)n", {1}},
+    {"C", {9, 6, 1}},
+    {"CC=C(C)C", {1}},
+    {"c1ccncc1", {1}},
+    {"CC(C)N", {1}},
+    {"CC", {1}},
+    {"CCC(C)O", {4}},
+    {"ccc(cc)n", {2}},
+    {"C1CCCC1", {1}},
+    {"CNCN", {1}},
+    {"cncn", {3}},
+    {"CSC", {1}},
+    {"CCNCCCN", {1}},
+    {"CccC", {1}},
+    {"ccccc(c)c", {3}}};
+
+// A dalke fragment that is already parsed into the RDKit molecule used as
+// the query in SubstructMatch
+struct DalkeFragment {
+  std::unique_ptr<const RDKit::ROMol> mol;
+  // the counts in the order of their bits
+  std::vector<unsigned int> counts;
+  // the highest of the counts. Once this many matches are found, all the
+  // bits of the fragment are known, and the search can stop
+  unsigned int max_count;
+};
+
+static std::vector<DalkeFragment> compile_dalke_fragments() {
+  std::vector<DalkeFragment> fragments;
+  fragments.reserve(dalke_counts.size());
+  for (const auto &dalke_count : dalke_counts) {
+    DalkeFragment fragment;
+    try {
+      fragment.mol.reset(RDKit::SmilesToMol(dalke_count.smiles, 0, false));
+    } catch (std::exception &e) {
+      std::string msg = StringUtil::Format("%s", typeid(e).name());
+      throw InvalidInputException(msg);
+    }
+    fragment.counts = dalke_count.counts;
+    fragment.max_count = *std::max_element(fragment.counts.begin(),
+                                           fragment.counts.end());
+    fragments.push_back(std::move(fragment));
+  }
+  return fragments;
+}
+
+// The fragments are parsed once for the whole process on first use, instead
+// of once per molecule. Initialization of a function-local static is
+// thread-safe, and the fragments are never modified afterwards, so they are
+// shared by all threads without locking
+static const std::vector<DalkeFragment> &get_dalke_fragments() {
+  static const std::vector<DalkeFragment> fragments =
+      compile_dalke_fragments();
+  return fragments;
+}
 
 uint64_t make_dalke_fp(const RDKit::ROMol &mol) {
-  std::bitset<64> bs;
+  uint64_t dalke_fp = 0;
   RDKit::SubstructMatchParameters params;
   params.uniquify = true;
   params.useQueryQueryMatches = false;
   params.recursionPossible = true;
   params.useChirality = false;
-  params.maxMatches = 10;
   params.numThreads = 1;
 
   uint8_t curBit = 0;
@@ -81,49 +134,94 @@ uint64_t make_dalke_fp(const RDKit::ROMol &mol) {
   // in the target molecule (the one that an UmbraMol will be constructed for)
   // the dalke fragment is the "query" molecule in the SubstructMatch
   // function
-  for (const auto &fp : dalke_counts) {
-    std::unique_ptr<RDKit::ROMol> dalke_fp_mol;
-
-    try {
-      dalke_fp_mol.reset(RDKit::SmilesToMol(fp[0], 0, false));
-    } catch (std::exception &e) {
-      std::string msg = StringUtil::Format("%s", typeid(e).name());
-      throw InvalidInputException(msg);
-    }
-
-    auto matchVect = RDKit::SubstructMatch(mol, *dalke_fp_mol, params);
+  for (const auto &fragment : get_dalke_fragments()) {
+    // One search per fragment sets all of its bits. Matches are uniquified
+    // while they are enumerated, so stopping at the highest count gives the
+    // same bits as counting every match
+    params.maxMatches = fragment.max_count;
+    auto num_matches = RDKit::SubstructMatch(mol, *fragment.mol, params).size();
 
     // if the target has the fp substructure in it at least $NUMBER of times
     // it appears, set that bit
-    for (auto i = 1; i < fp.size(); i++) {
-      if (matchVect.size() >= std::stoi(fp[i])) {
-        bs.set(curBit);
+    for (auto count : fragment.counts) {
+      if (num_matches >= count) {
+        dalke_fp |= uint64_t(1) << curBit;
       }
 
       curBit++;
     }
   }
-  auto k = bs.to_ullong();
   D_ASSERT(curBit == 55);
-  return k;
+  return dalke_fp;
+}
+
+// FNV-1a, followed by the finalizer of MurmurHash3 to mix the bits. The hash
+// is stored with the molecules, so it is computed here instead of with the
+// duckdb hash functions, which may change between duckdb versions
+static uint64_t hash_bytes(const std::string &data) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (auto c : data) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+uint64_t make_mol_hash(const RDKit::ROMol &mol) {
+  // mol_cmp ignores stereo, so the hash does too
+  return hash_bytes(RDKit::MolToSmiles(mol, false));
+}
+
+uint32_t mol_hash_version() {
+  static const uint32_t version = [] {
+    unsigned year = 0, month = 0, patch = 0;
+    // e.g. "2024.09.6", or "2025.03.1b1" for a pre-release
+    std::sscanf(RDKit::rdkitVersion, "%u.%u.%u", &year, &month, &patch);
+    return static_cast<uint32_t>(year * 10000 + month * 100 + patch);
+  }();
+  return version;
 }
 
 // "Umbra-mol" has more than just the binary molecule
 // There is a prefix in front of the binary molecule, inspired by
-// Umbra-style strings
+// Umbra-style strings, followed by the canonical hash. The canonical SMILES is
+// after the binary molecule
 std::string get_umbra_mol_string(const RDKit::ROMol &mol) {
   auto binary_mol = rdkit_mol_to_binary_mol(mol);
-  size_t total_size = umbra_mol_t::DALKE_FP_PREFIX_BYTES + binary_mol.size();
+  // the same SMILES as rdkit_mol_to_smiles gives for the deserialized
+  // molecule, so the casts to VARCHAR can return it as is
+  auto smiles = rdkit_mol_to_smiles(mol);
+  if (smiles.size() > NumericLimits<uint32_t>::Maximum()) {
+    throw InvalidInputException("SMILES of the molecule is too long");
+  }
+  auto smiles_size = static_cast<uint32_t>(smiles.size());
+  uint64_t hash = make_mol_hash(mol);
+  uint32_t hash_version = mol_hash_version();
+  size_t total_size = umbra_mol_t::DALKE_FP_PREFIX_BYTES +
+                      umbra_mol_t::HASH_SECTION_BYTES + binary_mol.size() +
+                      smiles.size() + umbra_mol_t::SMILES_SIZE_BYTES;
 
-  uint64_t dalke_fp = make_dalke_fp(mol);
+  uint64_t header = make_dalke_fp(mol) | umbra_mol_t::HAS_SMILES_FLAG |
+                    umbra_mol_t::HAS_HASH_FLAG;
 
   // remember to keep endianess in mind if you print things out.
   // little endian on my machine
   std::string buffer;
   buffer.reserve(total_size);
-  buffer.append(reinterpret_cast<const char *>(&dalke_fp),
+  buffer.append(reinterpret_cast<const char *>(&header),
                 umbra_mol_t::DALKE_FP_PREFIX_BYTES);
+  buffer.append(reinterpret_cast<const char *>(&hash), umbra_mol_t::HASH_BYTES);
+  buffer.append(reinterpret_cast<const char *>(&hash_version),
+                umbra_mol_t::HASH_VERSION_BYTES);
   buffer.append(binary_mol);
+  buffer.append(smiles);
+  buffer.append(reinterpret_cast<const char *>(&smiles_size),
+                umbra_mol_t::SMILES_SIZE_BYTES);
 
   return buffer;
 }